@@ -1,10 +1,13 @@
 #pragma once
 
 #include <cstdint>
-#include <memory>
 #include <vector>
 
-#include "interface/addressable.h"
+#include "decode_cache.h"
+#include "io.h"
+#include "memory_map.h"
+#include "ppu.h"
+#include "save_state.h"
 
 const uint16_t kRomBankStart = 0x0000;
 const uint16_t kRomBankEnd = 0x7FFF;
@@ -30,17 +33,70 @@ const uint16_t kHramEnd = 0xFFFE;
 const uint16_t kInterruptFlags = 0xFF0F;
 const uint16_t kInterruptEnable = 0xFFFF;
 
-class AddressBus : public Addressable {
+const uint16_t kRamLoadChunk = 64;  // bytes compared at a time by LoadState
+
+// Plain memory (rom banks, vram reads and wram) is accessed through a page
+// table, everything else goes to the component that owns it.
+//
+// The page table lookups are inline and the rest is left to CartBus, which
+// knows the mapper. That is the one virtual call between components: the
+// cpu's handler tables are shared by every mapper, so the cpu can only see
+// this base.
+class AddressBus {
  public:
   AddressBus();
   virtual ~AddressBus();
 
-  const uint8_t Read(const uint16_t addr);
-  void Write(const uint16_t addr, const uint8_t value);
+  const uint8_t Read(const uint16_t addr) {
+    const uint8_t* page = memoryMap_.read_[addr / kPageSize];
+    if (page) {
+      return page[addr % kPageSize];
+    }
+
+    return ReadUnmapped(addr);
+  }
+
+  void Write(const uint16_t addr, const uint8_t value) {
+    uint8_t* page = memoryMap_.write_[addr / kPageSize];
+    if (page) {
+      page[addr % kPageSize] = value;
+
+      if (decodeCache_) {
+        decodeCache_->Invalidate(addr);
+      }
+      return;
+    }
+
+    WriteUnmapped(addr, value);
+  }
+
+  virtual const uint8_t ReadUnmapped(const uint16_t addr) = 0;
+  virtual void WriteUnmapped(const uint16_t addr, const uint8_t value) = 0;
+  virtual void MapMemory() = 0;
 
-  std::shared_ptr<Addressable> cart_;
-  std::shared_ptr<Addressable> io_;
-  std::shared_ptr<Addressable> ppu_;
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
+  void LoadRam(StateReader& state, std::vector<uint8_t>& ram,
+               const uint16_t start);
+
+  IO* io_ = nullptr;
+  PPU* ppu_ = nullptr;
+  DecodeCache* decodeCache_ = nullptr;
   std::vector<uint8_t> wram_ = std::vector<uint8_t>(0x2000);
   std::vector<uint8_t> hram_ = std::vector<uint8_t>(0x80);
+  MemoryMap memoryMap_;
+};
+
+// The bus of a system with a given mapper, which it calls directly.
+template <typename Mapper>
+class CartBus final : public AddressBus {
+ public:
+  CartBus(Mapper& cart);
+  virtual ~CartBus();
+
+  const uint8_t ReadUnmapped(const uint16_t addr) override;
+  void WriteUnmapped(const uint16_t addr, const uint8_t value) override;
+  void MapMemory() override;
+
+  Mapper& cart_;
 };
@@ -47,17 +47,15 @@ static std::shared_ptr<Cart> CreateCartridge(std::string& filename) {
   return CreateCartridge(romBuffer);
 }
 
-static void SaveCartridge(const std::shared_ptr<Cart> cart,
-                          const std::string& filename) {
-  std::vector<uint8_t> saveData = cart->Save();
+static void SaveCartridge(Cart& cart, const std::string& filename) {
+  std::vector<uint8_t> saveData = cart.Save();
   std::ofstream out(filename,
                     std::ios::out | std::ios::binary | std::ios::trunc);
   out.write(reinterpret_cast<const char*>(saveData.data()), saveData.size());
   out.close();
 }
 
-static void LoadCartridge(const std::shared_ptr<Cart> cart,
-                          const std::string& filename) {
+static void LoadCartridge(Cart& cart, const std::string& filename) {
   std::ifstream in(filename, std::ios::in | std::ios::binary);
   in.unsetf(std::ios::skipws);
 
@@ -70,5 +68,5 @@ static void LoadCartridge(const std::shared_ptr<Cart> cart,
   buffer.insert(buffer.begin(), std::istream_iterator<uint8_t>(in),
                 std::istream_iterator<uint8_t>());
 
-  cart->Load(buffer);
+  cart.Load(buffer);
 }
\ No newline at end of file
@@ -6,6 +6,8 @@
 
 #include "cart/constants.h"
 #include "interface/addressable.h"
+#include "memory_map.h"
+#include "save_state.h"
 
 class Cart : public Addressable {
  public:
@@ -15,9 +17,13 @@ class Cart : public Addressable {
   virtual const std::string Describe();
   virtual const uint8_t Read(uint16_t addr);
   virtual void Write(uint16_t addr, uint8_t value);
+  virtual uint16_t RomBank();
+  virtual void MapRom(MemoryMap& memoryMap);
 
   virtual std::vector<uint8_t> Save();
   virtual void Load(const std::vector<uint8_t> saveData);
+  virtual void SaveState(StateWriter& state);
+  virtual void LoadState(StateReader& state);
 
   const std::vector<uint8_t> buffer_;
   const uint32_t size_;
@@ -33,6 +33,10 @@ class MBC3Cart : public Cart {
 
   virtual const uint8_t Read(uint16_t addr) override;
   virtual void Write(uint16_t addr, uint8_t value) override;
+  virtual uint16_t RomBank() override;
+  virtual void MapRom(MemoryMap& memoryMap) override;
+  virtual void SaveState(StateWriter& state) override;
+  virtual void LoadState(StateReader& state) override;
 
   const uint8_t ReadRomBank(const uint16_t addr);
   const uint8_t ReadRamBankOrTimer(const uint16_t addr);
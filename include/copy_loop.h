@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+#include "address_bus.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "registers.h"
+#include "scheduler.h"
+
+// longest loop, from its start to the backward jump, that is checked
+const uint16_t kCopyLoopMaxBytes = 12;
+
+// One byte stored per iteration, either loaded through another pointer or
+// the same value every time, until a counter runs out.
+struct CopyLoop {
+  uint16_t start = 0;
+  uint16_t branch = 0;  // the JR NZ back to start
+  uint32_t cycles = 0;  // m-cycles per iteration, 0 if the loop isn't one
+
+  // an 8 bit counter is DEC r, a 16 bit one DEC rr; LD A,hi; OR lo
+  RegisterType counter = RegisterType::NONE;
+
+  // NONE for a fill, whose value is loaded into A before the store
+  RegisterType source = RegisterType::NONE;
+  RegisterType destination = RegisterType::NONE;
+  RegisterType fill = RegisterType::NONE;  // A if it isn't reloaded
+  bool fillZero = false;                   // XOR A
+
+  // how far the pointer has moved when it's used, and each iteration
+  int sourceOffset = 0;
+  int destinationOffset = 0;
+  int steps[3] = {};  // BC, DE, HL
+};
+
+// Runs loops like `ld a,(hl+); ld (de),a; inc de; dec bc; ld a,b; or c;
+// jr nz` as native copies instead of instruction by instruction.
+//
+// When such a loop comes round, the iterations left before the last one
+// are run at once, as long as every byte they touch is plain memory and
+// none of them would reach the next event. Anything through the
+// components, like io or OAM, is left to the interpreter. The registers
+// and flags are set to what the interpreter would have left at the start
+// of the next iteration, and the last iteration runs normally so the loop
+// exits the same way.
+class CopyLoopRunner {
+ public:
+  CopyLoopRunner();
+  virtual ~CopyLoopRunner();
+
+  uint64_t Run(CPU& cpu, AddressBus& bus, PPU& ppu, Scheduler& scheduler,
+               const uint16_t from, const uint64_t until);
+  CopyLoop Analyze(CPU& cpu, const uint16_t start);
+  uint16_t CodeSize();
+  bool CodeMatches(AddressBus& bus);
+
+  // the last loop seen, so it isn't decoded every iteration
+  CopyLoop loop_;
+  bool analyzed_ = false;
+  uint8_t code_[kCopyLoopMaxBytes];
+};
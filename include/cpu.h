@@ -1,102 +1,134 @@
 #pragma once
 
-#include <memory>
-
+#include "address_bus.h"
+#include "decode_cache.h"
 #include "instructions.h"
 #include "interface/addressable.h"
 #include "interface/interrupt_handler.h"
 #include "registers.h"
+#include "save_state.h"
 
-class CPU : public Addressable, public InterruptHandler {
+class CPU final : public Addressable, public InterruptHandler {
  public:
   CPU();
   virtual ~CPU();
 
   void Boot();
   int Step();
-  void Fetch(InstructionContext& context);
-  void Decode(InstructionContext& context);
-  void Execute(InstructionContext& context);
+  DecodedInstruction Decode(const uint16_t addr);
+  void Trace(const uint8_t opcode);
 
   const uint8_t Read(const uint16_t addr);
   void Write(const uint16_t addr, const uint8_t value);
   void Request(const uint8_t interruptType);
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
   void HandleInterrupts();
   void CallVector(uint16_t address);
 
+  // dispatch
+  template <uint8_t opcode>
+  static void _execute(CPU& cpu);
+  template <uint8_t cbOpcode>
+  static void _executeCb(CPU& cpu);
+
   // handlers
-  void _nop(InstructionContext& context);
-  void _jp(InstructionContext& context);
-  void _xor(InstructionContext& context);
-  void _ld16(InstructionContext& context);
-  void _ld(InstructionContext& context);  // can this cover all ld types?
-  void _dec(InstructionContext& context);
-  void _inc(InstructionContext& context);
-  void _jr(InstructionContext& context);
-  void _di(InstructionContext& context);
-  void _ei(InstructionContext& context);
-  void _ldh(InstructionContext& context);
-  void _halt(InstructionContext& context);
-  void _cp(InstructionContext& context);
-  void _rst(InstructionContext& context);
-  void _add(InstructionContext& context);
-  void _adc(InstructionContext& context);
-  void _pop(InstructionContext& context);
-  void _sub(InstructionContext& context);
-  void _sbc(InstructionContext& context);
-  void _and(InstructionContext& context);
-  void _or(InstructionContext& context);
-  void _inc16(InstructionContext& context);
-  void _dec16(InstructionContext& context);
-  void _add16(InstructionContext& context);
-  void _push(InstructionContext& context);
-  void _rlca(InstructionContext& context);
-  void _rrca(InstructionContext& context);
-  void _rla(InstructionContext& context);
-  void _rra(InstructionContext& context);
-  void _daa(InstructionContext& context);
-  void _cpl(InstructionContext& context);
-  void _scf(InstructionContext& context);
-  void _ccf(InstructionContext& context);
-  void _stop(InstructionContext& context);
-  void _ret(InstructionContext& context);
-  void _reti(InstructionContext& context);
-  void _call(InstructionContext& context);
-  void _addSpR8(InstructionContext& context);
-  void _ldHlSpR8(InstructionContext& context);
-  void _ldSpHl(InstructionContext& context);
-  void _ldA16Sp(InstructionContext& context);
-  void _prefixCb(InstructionContext& context);
+  void _nop();
+  template <ConditionType condition>
+  void _jp(const uint16_t address);
+  void _xor(const uint8_t value);
+  template <ArgumentType destination>
+  void _ld(const uint16_t value);  // covers LD, LD_16 and LDH
+  template <ArgumentType source>
+  void _dec(const uint8_t value);
+  template <ArgumentType source>
+  void _inc(const uint8_t value);
+  template <ConditionType condition>
+  void _jr(const uint8_t offset);
+  void _di();
+  void _ei();
+  void _halt();
+  void _cp(const uint8_t value);
+  void _rst(const uint8_t address);
+  void _add(const uint8_t value);
+  void _adc(const uint8_t value);
+  template <ArgumentType destination>
+  void _pop();
+  void _sub(const uint8_t value);
+  void _sbc(const uint8_t value);
+  void _and(const uint8_t value);
+  void _or(const uint8_t value);
+  template <ArgumentType source>
+  void _inc16(const uint16_t value);
+  template <ArgumentType source>
+  void _dec16(const uint16_t value);
+  void _add16(const uint16_t value);
+  void _push(const uint16_t value);
+  void _rlca();
+  void _rrca();
+  void _rla();
+  void _rra();
+  void _daa();
+  void _cpl();
+  void _scf();
+  void _ccf();
+  void _stop();
+  template <ConditionType condition>
+  void _ret();
+  void _reti();
+  template <ConditionType condition>
+  void _call(const uint16_t address);
+  void _addSpR8(const uint8_t value);
+  void _ldHlSpR8(const uint8_t value);
+  void _ldSpHl(const uint16_t value);
+  void _ldA16Sp(const uint16_t value);
+  void _prefixCb();
 
   // helpers
-  uint16_t _readData(ArgumentType argumentType);
+  template <ArgumentType argumentType>
+  uint16_t _readData();
   uint8_t _readMem(uint16_t addr);
   uint16_t _readImm16();
   uint8_t _readImm8();
-  bool _checkCondition(ConditionType conditionType);
-  void _writeData(ArgumentType argumentType, uint16_t data);
+  template <ConditionType conditionType>
+  bool _checkCondition();
+  template <ArgumentType argumentType>
+  void _writeData(uint16_t data);
   void _writeMem(uint16_t addr, uint8_t data);
   void _stackPush(uint8_t data);
   void _stackPushWord(uint16_t data);
   uint8_t _stackPop();
   uint16_t _stackPopWord();
   void _savePCToStack();
-  void _cbRlc(ArgumentType dataSource);
-  void _cbRrc(ArgumentType dataSource);
-  void _cbRl(ArgumentType dataSource);
-  void _cbRr(ArgumentType dataSource);
-  void _cbSla(ArgumentType dataSource);
-  void _cbSra(ArgumentType dataSource);
-  void _cbSwap(ArgumentType dataSource);
-  void _cbSrl(ArgumentType dataSource);
-  void _cbBit(uint8_t bit, ArgumentType dataSource);
-  void _cbRes(uint8_t bit, ArgumentType dataSource);
-  void _cbSet(uint8_t bit, ArgumentType dataSource);
+  template <ArgumentType dataSource>
+  void _cbRlc();
+  template <ArgumentType dataSource>
+  void _cbRrc();
+  template <ArgumentType dataSource>
+  void _cbRl();
+  template <ArgumentType dataSource>
+  void _cbRr();
+  template <ArgumentType dataSource>
+  void _cbSla();
+  template <ArgumentType dataSource>
+  void _cbSra();
+  template <ArgumentType dataSource>
+  void _cbSwap();
+  template <ArgumentType dataSource>
+  void _cbSrl();
+  template <uint8_t bit, ArgumentType dataSource>
+  void _cbBit();
+  template <uint8_t bit, ArgumentType dataSource>
+  void _cbRes();
+  template <uint8_t bit, ArgumentType dataSource>
+  void _cbSet();
 
   Registers registers_;
-  std::shared_ptr<Addressable> memory_;
+  AddressBus* memory_ = nullptr;
+  DecodeCache* decodeCache_ = nullptr;
 
   uint64_t cycles_ = 0;
+  uint16_t operand_ = 0;  // immediate bytes of the executing instruction
 
   // state
   bool ime_ = false;
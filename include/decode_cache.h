@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class CPU;
+
+// one handler per opcode, generated from kInstructions at compile time
+using OpcodeHandler = void (*)(CPU& cpu);
+
+const uint16_t kDecodeCacheBankSize = 0x4000;
+
+struct DecodedInstruction {
+  OpcodeHandler handler = nullptr;
+  uint16_t operand = 0;  // immediate bytes following the opcode, little endian
+  uint8_t opcode = 0x00;
+  uint8_t length = 0;  // bytes fetched, which is also the fetch m-cycle count.
+                       // 0 marks an entry that has not been decoded yet
+};
+
+using DecodedBank = std::array<DecodedInstruction, kDecodeCacheBankSize>;
+
+// Holds decoded instructions for every address that has been executed from
+// ROM, WRAM or HRAM. ROM entries are keyed by (bank, address) so switching
+// banks just selects a different set of entries, while RAM entries are
+// invalidated whenever the bytes underneath them are written.
+class DecodeCache {
+ public:
+  DecodeCache();
+  virtual ~DecodeCache();
+
+  DecodedInstruction* Find(const uint16_t addr);
+  void Invalidate(const uint16_t addr);
+  void SelectRomBank(const uint16_t bank);
+  DecodedBank* GetRomBank(const uint16_t bank);
+
+  std::vector<std::unique_ptr<DecodedBank>> romBanks_;
+  DecodedBank* switchableBank_ = nullptr;
+  std::vector<DecodedInstruction> wram_ =
+      std::vector<DecodedInstruction>(0x2000);
+  std::vector<DecodedInstruction> hram_ = std::vector<DecodedInstruction>(0x80);
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Inline storage replacements for the std containers the ppu uses per line,
+// so rendering never touches the heap. The interfaces follow the std ones
+// they replace. Neither checks capacity, callers stay within it.
+
+template <typename T, size_t N>
+class FixedVector {
+ public:
+  void push_back(const T& value) { data_[size_++] = value; }
+
+  // shifts the rest up to make room at index
+  void insert(const size_t index, const T& value) {
+    for (size_t i = size_; i > index; i--) {
+      data_[i] = data_[i - 1];
+    }
+    data_[index] = value;
+    size_++;
+  }
+
+  void clear() { size_ = 0; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  T& operator[](const size_t index) { return data_[index]; }
+  const T& operator[](const size_t index) const { return data_[index]; }
+
+  T* begin() { return data_.data(); }
+  T* end() { return data_.data() + size_; }
+  const T* begin() const { return data_.data(); }
+  const T* end() const { return data_.data() + size_; }
+
+ private:
+  std::array<T, N> data_ = {};
+  size_t size_ = 0;
+};
+
+// N must be a power of two
+template <typename T, size_t N>
+class RingBuffer {
+  static_assert((N & (N - 1)) == 0, "RingBuffer size must be a power of two");
+
+ public:
+  void push(const T& value) { data_[(head_ + size_++) & (N - 1)] = value; }
+
+  void pop() {
+    head_ = (head_ + 1) & (N - 1);
+    size_--;
+  }
+
+  T& front() { return data_[head_]; }
+
+  void clear() {
+    head_ = 0;
+    size_ = 0;
+  }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  std::array<T, N> data_ = {};
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
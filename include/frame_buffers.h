@@ -0,0 +1,37 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Triple buffering between the thread drawing frames and the one showing
+// them, without either waiting on the other.
+//
+// The producer draws into the back buffer and Publish swaps it with the
+// middle one. The presenter's Acquire swaps the middle one with its front
+// buffer when a newer frame is there, so it only ever sees whole frames.
+// The middle index and a flag marking it as unseen share one atomic, which
+// makes each swap a single exchange.
+class FrameBuffers {
+ public:
+  FrameBuffers(const size_t size);
+  virtual ~FrameBuffers();
+
+  // producer
+  uint32_t* Back();
+  void Publish();
+
+  // presenter
+  uint64_t Acquire();
+  const uint32_t* Front();
+
+  std::array<std::vector<uint32_t>, 3> buffers_;
+  std::array<uint64_t, 3> sequences_ = {};  // 0 until a frame is published
+
+  uint8_t back_ = 0;
+  std::atomic<uint8_t> middle_{1};
+  uint8_t front_ = 2;
+  uint64_t published_ = 0;
+};
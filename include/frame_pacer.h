@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// 4194304 Hz clock over 70224 cycles per frame, about 59.73 Hz
+const double kGameBoyFrameRate = 4194304.0 / 70224.0;
+
+// sleeping is only accurate to a scheduler tick, the end is spun out
+const int64_t kFramePacerSpinNs = 1000000;
+
+struct FramePacerStats {
+  uint32_t frames = 0;
+  double meanMs = 0;
+  double jitterMs = 0;  // standard deviation of the frame time
+  double minMs = 0;
+  double maxMs = 0;
+  uint32_t late = 0;  // frames that missed their deadline by over a frame
+};
+
+// Paces frames to absolute deadlines, so the time spent sleeping and
+// emulating doesn't accumulate as drift. Each deadline is one period after
+// the last rather than after whenever the frame happened to finish. A
+// frame that falls more than a period behind restarts the deadlines from
+// now instead of running the following frames fast to catch up.
+class FramePacer {
+ public:
+  FramePacer(const double rate = kGameBoyFrameRate);
+  virtual ~FramePacer();
+
+  void SetRate(const double rate);
+  void Reset();
+  void Wait();
+  FramePacerStats TakeStats();
+
+  int64_t periodNs_ = 0;
+  int64_t deadline_ = 0;  // absolute time of the next frame
+  int64_t lastFrame_ = 0;
+
+  // frame times since the last TakeStats, Welford's running variance
+  FramePacerStats stats_;
+  double m2_ = 0;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "address_bus.h"
+#include "cart/cart.h"
+#include "copy_loop.h"
+#include "cpu.h"
+#include "decode_cache.h"
+#include "idle_loop.h"
+#include "io.h"
+#ifdef OSTRICH_JIT
+#include "jit.h"
+#endif
+#include "ppu.h"
+#include "save_state.h"
+#include "scheduler.h"
+#include "timer.h"
+
+const uint64_t kCyclesPerFrame = kCyclesPerLine * kLinesPerFrame;
+
+// The components of a Game Boy, owned in one object and connected to each
+// other directly. Frontends use this so they don't depend on the mapper.
+class System {
+ public:
+  System();
+  virtual ~System();
+
+  System(const System&) = delete;
+  System& operator=(const System&) = delete;
+
+  virtual Cart& GetCart() = 0;
+  virtual bool RunCycles(const uint64_t cycles) = 0;
+  virtual bool RunFrame() = 0;
+  bool RunAhead(const uint32_t frames);
+  void SaveState(std::vector<uint8_t>& state);
+  bool LoadState(const std::vector<uint8_t>& state);
+  void SetPPUCatchUp(const bool catchUp);
+#ifdef OSTRICH_JIT
+  void EnableJit(const bool perfMap);
+#endif
+
+  Scheduler scheduler_;
+  DecodeCache decodeCache_;
+  Timer timer_;
+  PPU ppu_;
+  IO io_;
+  AddressBus* addressBus_ = nullptr;  // the GameBoy's bus for its mapper
+  CPU cpu_;
+  CopyLoopRunner copyLoops_;
+  IdleLoopDetector idleLoops_;
+#ifdef OSTRICH_JIT
+  std::unique_ptr<JIT> jit_ = nullptr;
+#endif
+
+  uint64_t lastCycles_ = 0;  // cpu cycles already added to the master clock
+  std::vector<uint8_t> runAheadState_;
+
+ protected:
+  void Connect(Cart& cart, AddressBus& addressBus);
+};
+
+// Holds the cartridge by value as well, so nothing in the system is
+// allocated or reached through a pointer it owns, and the bus that calls it
+// without going through Cart's virtual functions.
+template <typename Mapper>
+class GameBoy final : public System {
+ public:
+  GameBoy(std::vector<uint8_t>& romBuffer);
+  virtual ~GameBoy();
+
+  Cart& GetCart() override;
+  bool RunCycles(const uint64_t cycles) override;
+  bool RunFrame() override;
+  bool Step(const uint64_t until = kSchedulerNever);
+
+  Mapper cart_;
+  CartBus<Mapper> bus_;
+};
+
+std::unique_ptr<System> CreateGameBoy(std::vector<uint8_t>& romBuffer);
+std::unique_ptr<System> CreateGameBoy(const std::string& filename);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "cpu.h"
+#include "ppu.h"
+#include "scheduler.h"
+
+// longest loop, from its start to the backward jump, that is checked
+const uint16_t kIdleLoopMaxBytes = 16;
+
+struct IdleLoop {
+  uint16_t start = 0;
+  uint16_t branch = 0;    // the JR or JP back to start
+  uint32_t cycles = 0;    // m-cycles per iteration, 0 if the loop isn't idle
+  bool readsLy = false;
+  bool readsStat = false;
+};
+
+// Skips polling loops like `ldh a,(44); cp 90; jr nz` without running them.
+//
+// A loop is idle when its body only loads A from memory and tests it
+// against itself, immediates or registers the body doesn't write. Every
+// iteration then ends in the same state until one of the values it reads
+// changes. Apart from LY and STAT, the memory allowed is only written by the
+// cpu itself, so nothing can change until an event runs and maybe raises an
+// interrupt. LY changes as the ppu's line ends and STAT at its next mode
+// event, both known from where it was last synced.
+//
+// Once the loop comes round twice in a row exactly one iteration apart,
+// with the same AF, the iterations left before either of those are added
+// to the clock in one go.
+class IdleLoopDetector {
+ public:
+  IdleLoopDetector();
+  virtual ~IdleLoopDetector();
+
+  uint64_t Skip(CPU& cpu, PPU& ppu, Scheduler& scheduler, const uint16_t from,
+                const uint64_t until);
+  IdleLoop Analyze(CPU& cpu, const uint16_t start);
+  void Reset();
+
+  IdleLoop loop_;
+  bool analyzed_ = false;
+
+  // as of the last time the loop came round
+  uint64_t arrivalCycles_ = 0;
+  uint16_t arrivalAF_ = 0;
+  uint64_t ppuStable_ = 0;  // master clock LY or STAT hold until
+};
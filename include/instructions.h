@@ -92,15 +92,8 @@ struct Instruction {
   ConditionType condition = ConditionType::NONE;
 };
 
-struct InstructionContext {
-  uint16_t pc;
-  Instruction instruction;
-  bool is16Bit = false;
-  uint16_t source = 0;
-};
-
 // clang-format off
-static Instruction kInstructions[] = {
+static constexpr Instruction kInstructions[] = {
     // 0x
     {    0x00,    "NOP",             InstructionType::NOP, },
     {    0x01,    "LD BC,d16",       InstructionType::LD_16,          ArgumentType::BC,               ArgumentType::IMM_16,           ConditionType::NONE },
@@ -113,7 +106,7 @@ static Instruction kInstructions[] = {
     {    0x08,    "LD (a16),SP",     InstructionType::LD_A16_SP,      ArgumentType::MEM_AT_A16,       ArgumentType::SP,               ConditionType::NONE },
     {    0x09,    "ADD HL,BC",       InstructionType::ADD16,          ArgumentType::HL,               ArgumentType::BC,               ConditionType::NONE },
     {    0x0A,    "LD A,(BC)",       InstructionType::LD,             ArgumentType::A,                ArgumentType::MEM_AT_BC,        ConditionType::NONE },
-    {    0x03,    "DEC BC",          InstructionType::DEC16,          ArgumentType::NONE,             ArgumentType::BC,               ConditionType::NONE },
+    {    0x0B,    "DEC BC",          InstructionType::DEC16,          ArgumentType::NONE,             ArgumentType::BC,               ConditionType::NONE },
     {    0x0C,    "INC C",           InstructionType::INC,            ArgumentType::NONE,             ArgumentType::C,                ConditionType::NONE },
     {    0x0D,    "DEC C",           InstructionType::DEC,            ArgumentType::NONE,             ArgumentType::C,                ConditionType::NONE },
     {    0x0E,    "LD C,d8",         InstructionType::LD,             ArgumentType::C,                ArgumentType::IMM_8,            ConditionType::NONE },
@@ -391,6 +384,29 @@ static Instruction kInstructions[] = {
 };
 // clang-format on
 
+constexpr uint8_t ArgumentTypeOperandBytes(ArgumentType type) {
+  switch (type) {
+    case ArgumentType::IMM_16:
+    case ArgumentType::MEM_AT_A16:
+      return 2;
+    case ArgumentType::IMM_8:
+    case ArgumentType::MEM_AT_A8:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// opcode plus any immediate bytes, with the CB opcode counted as an operand
+constexpr uint8_t InstructionLength(const Instruction& instruction) {
+  if (instruction.type == InstructionType::PREFIX_CB) {
+    return 2;
+  }
+
+  return 1 + ArgumentTypeOperandBytes(instruction.destination) +
+         ArgumentTypeOperandBytes(instruction.source);
+}
+
 static constexpr ArgumentType kArgumentTypeFromCBSource[] = {
     ArgumentType::B, ArgumentType::C, ArgumentType::D,         ArgumentType::E,
     ArgumentType::H, ArgumentType::L, ArgumentType::MEM_AT_HL, ArgumentType::A,
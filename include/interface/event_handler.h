@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+enum class EventType {
+  PPU_MODE,        // mode and line changes, including the OAM scan
+  TIMER_OVERFLOW,  // TIMA reload and timer interrupt
+  DMA,             // next OAM DMA transfer, the last one completes it
+  FRAME_END,       // entering VBLANK
+};
+
+const uint32_t kEventTypeCount = 4;
+
+class EventHandler {
+ public:
+  EventHandler(){};
+  virtual ~EventHandler(){};
+
+  virtual void HandleEvent(const EventType type) = 0;
+};
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <cstdint>
-#include <memory>
 
 #include "interface/addressable.h"
+#include "ppu.h"
+#include "save_state.h"
+#include "timer.h"
+
+class CPU;
 
 const uint8_t kIOSelectButtons = 0x01 << 5;
 const uint8_t kIOSelectDPad = 0x01 << 4;
@@ -12,22 +16,24 @@ const uint8_t kIOSelectUp = 0x01 << 2;
 const uint8_t kIOBLeft = 0x01 << 1;
 const uint8_t kIOARight = 0x01 << 0;
 
-class IO : public Addressable {
+class IO final : public Addressable {
  public:
   IO();
   virtual ~IO();
 
   const uint8_t Read(const uint16_t addr);
   void Write(const uint16_t addr, const uint8_t value);
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
 
   void UpdateJoypad(uint8_t button, bool set);
   uint8_t GetJoypad();
   bool ButtonSelect();
   bool DPadSelect();
 
-  std::shared_ptr<Addressable> timer_ = nullptr;
-  std::shared_ptr<Addressable> cpu_ = nullptr;
-  std::shared_ptr<Addressable> ppu_ = nullptr;
+  Timer* timer_ = nullptr;
+  CPU* cpu_ = nullptr;
+  PPU* ppu_ = nullptr;
 
   uint8_t joypad_;         // 0xFF00
   uint8_t serialData_;     // 0xFF01
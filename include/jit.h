@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "cart/cart.h"
+#include "cpu.h"
+
+const uint32_t kJitCodeBufferSize = 4 * 1024 * 1024;
+const uint32_t kJitHotThreshold = 16;  // executions before a block is compiled
+const uint32_t kJitMaxBlockInstructions = 64;
+
+// compiled blocks take the cpu they operate on as their only argument
+using JitBlockFunction = void (*)(CPU* cpu);
+
+struct JitBlock {
+  JitBlockFunction code = nullptr;
+  uint32_t maxCycles = 0;  // m-cycles if every branch in the block is taken
+  uint32_t hits = 0;
+  bool uncompilable = false;  // first instruction can't be compiled
+};
+
+using JitBank = std::array<JitBlock, 0x4000>;
+
+// Optional x86-64 backend that runs alongside the CPU::Step interpreter.
+//
+// Blocks are only built from ROM, which can't be modified, and only from
+// instructions that don't touch the bus beyond their own immediates. A block
+// may end with a JP/JR. Since nothing inside a block can observe or change
+// the rest of the system, running the whole block and then ticking the PPU
+// and Timer for its cycles gives the same results as stepping it. Anything
+// else, including all memory and I/O accesses, runs in the interpreter.
+// Callers that know when the next interrupt can be raised pass that as the
+// cycle budget, and blocks that could run past it are interpreted instead.
+class JIT {
+ public:
+  JIT(CPU& cpu, Cart& cart, bool perfMap);
+  virtual ~JIT();
+
+  int Step(const uint32_t maxCycles = UINT32_MAX);
+  JitBlock* FindBlock(const uint16_t addr);
+  bool Compile(JitBlock& block, const uint16_t addr);
+  void Flush();
+
+  // emitters
+  void EmitByte(const uint8_t byte);
+  void EmitWord(const uint16_t word);
+  void EmitDoubleWord(const uint32_t doubleWord);
+  void EmitQuadWord(const uint64_t quadWord);
+  void EmitRegisterMemoryOp(const std::vector<uint8_t>& prefix,
+                            const uint8_t reg, const void* field);
+  void EmitCall(const OpcodeHandler handler);
+  bool EmitNative(const Instruction& instruction,
+                  const DecodedInstruction& decoded, uint32_t& cycles);
+
+  CPU& cpu_;
+  Cart& cart_;
+
+  std::vector<std::unique_ptr<JitBank>> banks_;
+
+  uint8_t* code_ = nullptr;
+  uint32_t codeSize_ = 0;
+  FILE* perfMap_ = nullptr;
+
+  uint64_t compiledBlocks_ = 0;
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+const uint32_t kPageSize = 0x100;
+const uint32_t kPageCount = 0x10000 / kPageSize;
+
+// Pointers to the memory mapped into each 256 byte page of the address
+// space, so plain memory can be accessed without going through a component.
+// A null entry means the page has to go through the owner's Read/Write,
+// which is always correct, just slower.
+class MemoryMap {
+ public:
+  MemoryMap();
+  virtual ~MemoryMap();
+
+  void Map(const uint16_t start, const uint16_t end, const uint8_t* data);
+  void MapWritable(const uint16_t start, const uint16_t end, uint8_t* data);
+  void Unmap(const uint16_t start, const uint16_t end);
+
+  std::array<const uint8_t*, kPageCount> read_ = {};
+  std::array<uint8_t*, kPageCount> write_ = {};
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Pixel conversion kernels shared by the tile cache and both renderers.
+// Picks AVX2, SSE2 or WASM SIMD at compile time from the target flags, with a
+// scalar fallback for anything else.
+
+// 2bpp bit planes to 8 color indices, leftmost pixel first unless flipped
+void DecodeTileRow(const uint8_t low, const uint8_t high, const bool xFlip,
+                   uint8_t* indices);
+
+// out[i] = palette[indices[i]] for indices 0-3
+void ApplyPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* out,
+                  const size_t count);
+
+// out[i] = colors[shades[i]] for shades 0-3
+void ExpandColors(const uint8_t* shades, const uint32_t* colors, uint32_t* out,
+                  const size_t count);
+
+const char* PixelKernelsName();
@@ -1,12 +1,20 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <memory>
-#include <queue>
 #include <vector>
 
+#include "fixed_containers.h"
+#include "frame_buffers.h"
 #include "interface/addressable.h"
-#include "interface/interrupt_handler.h"
+#include "interface/event_handler.h"
+#include "save_state.h"
+#include "scheduler.h"
+#include "tile_cache.h"
+
+class AddressBus;
+class CPU;
 
 const uint32_t kLCDWidth = 160;
 const uint32_t kLCDHeight = 144;
@@ -14,6 +22,8 @@ const uint32_t kLCDHeight = 144;
 const uint32_t kCyclesPerOamScan = 80;
 const uint32_t kCyclesPerLine = 456;
 const uint32_t kLinesPerFrame = 154;
+const uint32_t kMaxSpritesPerLine = 10;
+const uint32_t kFIFOSize = 16;  // 8 queued pixels plus a fetch of 8
 
 const uint8_t kLCDStatIntLyc = 0x01 << 6;
 const uint8_t kLCDStatIntOam = 0x01 << 5;     // Mode 2
@@ -57,12 +67,14 @@ struct OAMData {
   uint8_t priority : 1;
 };
 
+const TileRow kBlankTileRow = {};
+
 struct SpritePixelFIFOEntry {
   OAMData* oamData;
   uint8_t colorIndex;
 };
 
-class PPU : public Addressable {
+class PPU final : public Addressable, public EventHandler {
  public:
   PPU();
   virtual ~PPU();
@@ -79,17 +91,33 @@ class PPU : public Addressable {
   void FetchTile();
   void FetchTileDataLow();
   void FetchTileDataHigh();
+  uint16_t SpriteRowOffset(const OAMData& sprite);
   void FetchSleep();
   void PushToFIFO();
   void PushPixelToLCD();
+  void FlushPushedPixels();
+  uint32_t PixelTransferEnd();
+  void RenderScanline();
 
   void DMAInit(const uint8_t start);
   void DMAProcess();
 
+  // scheduler driven updates
+  void HandleEvent(const EventType type);
+  void Sync();
+  void ScheduleEvents();
+  uint32_t CyclesUntilModeEvent();
+  uint32_t CyclesUntilInterrupt();
+  uint32_t CyclesUntilLineEnd();
+  uint32_t CyclesUntilVramRead();
+  uint32_t CyclesUntilDMA();
+
   const uint8_t Read(const uint16_t addr);
   void Write(const uint16_t addr, const uint8_t value);
   const uint8_t OAMRead(const uint16_t addr);
   void OAMWrite(const uint16_t addr, const uint8_t value);
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
 
   void SetMode(Mode mode);
   Mode GetMode();
@@ -111,11 +139,19 @@ class PPU : public Addressable {
 
   std::vector<OAMData> oam_ = std::vector<OAMData>(40);
   std::vector<uint8_t> vram_ = std::vector<uint8_t>(0x2000);
+  TileCache tileCache_;
 
-  std::vector<uint32_t> screenBuffer_ =
-      std::vector<uint32_t>(kLCDHeight * kLCDWidth);
+  // lines are drawn into the back buffer, which is published at VBLANK
+  FrameBuffers frameBuffers_{kLCDHeight * kLCDWidth};
+  uint32_t* screenBuffer_ = frameBuffers_.Back();
 
-  std::shared_ptr<InterruptHandler> interruptHandler_ = nullptr;
+  CPU* cpu_ = nullptr;
+  Scheduler* scheduler_ = nullptr;
+  uint64_t lastSync_ = 0;  // master clock the ppu has been ticked up to
+  bool syncing_ = false;   // the ppu's own reads go back through Read
+  // only sync when observed, written or about to raise an interrupt, rather
+  // than at every mode change
+  bool catchUp_ = false;
 
   // LCD
   uint8_t lcdc_ = 0x91;  // 0xFF40
@@ -131,31 +167,42 @@ class PPU : public Addressable {
   uint8_t wx_ = 0;       // 0xFF4B
 
   // pixel pipeline state/vars
-  std::queue<uint8_t> backgroundFIFO_;
-  std::queue<SpritePixelFIFOEntry> spriteFIFO_;
+  RingBuffer<uint8_t, kFIFOSize> backgroundFIFO_;
+  RingBuffer<SpritePixelFIFOEntry, kFIFOSize> spriteFIFO_;
   PixelFetcherStep fetchStep_ = TILE;
   uint8_t fetcherX_ = 0;  // track where the fetcher is in the current line
   uint8_t tileNumber_ = 0;
-  uint8_t tileDataLow_ = 0;
-  uint8_t tileDataHigh_ = 0;
+  uint16_t tileRowOffset_ = 0;
+  TileRow tileRow_ = {};
   uint8_t backgroundPalette_[4];  // holds the palette selections as indices of
                                   // the defaultColors
   uint8_t lcdPushedX_ = 0;
   uint8_t lcdLineX_ = 0;
+  // shades pushed this line, colored a batch at a time
+  std::array<uint8_t, kLCDWidth> lineShades_ = {};
+  uint8_t lcdFlushedX_ = 0;
   uint8_t windowY_ = 0;  //
   uint8_t fifoPushedX_ = 0;
+  // render each line in one pass as HBLANK starts, pixel transfer is just
+  // timed using scx at the start of the line
+  bool scanline_ = false;
+  uint32_t pixelTransferEnd_ = 0;
+  // keep every mode change and interrupt but leave screenBuffer_ alone, for
+  // frames nobody will see, and don't publish them. Only scanline rendering
+  // saves the pixel work, the fifo still runs since it decides when pixel
+  // transfer ends
+  bool skipRender_ = false;
   // sprite fifo
-  std::vector<OAMData> spritesInLine_;
-  std::vector<OAMData> fetchedSprites_;
-  std::vector<uint8_t> oamDataLow_;
-  std::vector<uint8_t> oamDataHigh_;
+  FixedVector<OAMData, kMaxSpritesPerLine> spritesInLine_;
+  FixedVector<OAMData, kMaxSpritesPerLine> fetchedSprites_;
+  std::array<TileRow, kMaxSpritesPerLine> spriteRows_ = {};
   uint8_t sprite1Palette_[4];  // holds the palette selections as indices of the
                                // defaultColors
   uint8_t sprite2Palette_[4];  // holds the palette selections as indices of the
                                // defaultColors
 
   // DMA
-  std::shared_ptr<Addressable> memory_ = nullptr;
+  AddressBus* memory_ = nullptr;
   uint8_t dmaOffset_ = 0;  // 0xFF46
   bool dmaActive_ = false;
   uint8_t dmaByte_;
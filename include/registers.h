@@ -25,6 +25,18 @@ enum class RegisterType {
   L,
 };
 
+// The last operation that set the flags, kept with its result and operands
+// until the flags are read. INC, DEC and BIT leave the carry as it was, so
+// they come first and only need what's already in F.
+enum class FlagOp : uint8_t {
+  NONE,  // F is up to date
+  INC,
+  DEC,
+  BIT,  // the result is the tested bit, masked
+  ADD,
+  SUB,  // also CP, whose result is thrown away
+};
+
 class Registers {
  public:
   Registers() {}
@@ -116,7 +128,10 @@ class Registers {
   }
 
   // 2 byte register accessors
-  uint16_t& AF() { return *((uint16_t*)af_); }
+  uint16_t& AF() {
+    ResolveFlags();
+    return *((uint16_t*)af_);
+  }
 
   uint16_t& BC() { return *((uint16_t*)bc_); }
 
@@ -131,7 +146,10 @@ class Registers {
   // accesss single byte registers
   uint8_t& A() { return af_[1]; }
 
-  uint8_t& Flags() { return af_[0]; }
+  uint8_t& Flags() {
+    ResolveFlags();
+    return af_[0];
+  }
 
   uint8_t& B() { return bc_[1]; }
 
@@ -145,14 +163,30 @@ class Registers {
 
   uint8_t& L() { return hl_[0]; }
 
-  // check flags
-  bool GetZeroFlag() { return (Flags() >> kZeroFlagBit) & 0x1; }
+  // check flags, Z and C being the ones conditions test are worked out
+  // without resolving the rest
+  bool GetZeroFlag() {
+    if (flagOp_ == FlagOp::NONE) {
+      return (af_[0] >> kZeroFlagBit) & 0x1;
+    }
+
+    return flagResult_ == 0;
+  }
 
   bool GetSubFlag() { return (Flags() >> kAddSubFlagBit) & 0x1; }
 
   bool GetHalfCarryFlag() { return (Flags() >> kHalfCarryFlagBit) & 0x1; }
 
-  bool GetCarryFlag() { return (Flags() >> kCarryFlagBit) & 0x1; }
+  bool GetCarryFlag() {
+    switch (flagOp_) {
+      case FlagOp::ADD:
+        return flagResult_ < flagA_;
+      case FlagOp::SUB:
+        return flagA_ < flagB_;
+      default:
+        return (af_[0] >> kCarryFlagBit) & 0x1;
+    }
+  }
 
   // set/clear flags individually
   void SetZeroFlag() { Flags() |= (0x1 << kZeroFlagBit); }
@@ -182,6 +216,62 @@ class Registers {
 
   void SetCarryFlag(const bool b) { b ? SetCarryFlag() : ClearCarryFlag(); }
 
+  // all four flags at once, dropping anything pending
+  void SetFlags(const uint8_t flags) {
+    af_[0] = (af_[0] & 0x0F) | flags;
+    flagOp_ = FlagOp::NONE;
+  }
+
+  // leaves the flags to be worked out from op when they're next read
+  void DeferFlags(const FlagOp op, const uint8_t result, const uint8_t a = 0,
+                  const uint8_t b = 0) {
+    // those that keep the carry find it in F, the rest of which they set
+    if (op < FlagOp::ADD && flagOp_ >= FlagOp::ADD) {
+      af_[0] = (af_[0] & ~(0x1 << kCarryFlagBit)) |
+               (GetCarryFlag() << kCarryFlagBit);
+    }
+
+    flagOp_ = op;
+    flagResult_ = result;
+    flagA_ = a;
+    flagB_ = b;
+  }
+
+  void ResolveFlags() {
+    if (flagOp_ == FlagOp::NONE) {
+      return;
+    }
+
+    uint8_t flags = (af_[0] & 0x0F) | (GetZeroFlag() << kZeroFlagBit) |
+                    (GetCarryFlag() << kCarryFlagBit);
+
+    switch (flagOp_) {
+      case FlagOp::INC:
+        flags |= ((flagResult_ & 0x0F) == 0x00) << kHalfCarryFlagBit;
+        break;
+      case FlagOp::DEC:
+        flags |= (0x1 << kAddSubFlagBit) |
+                 (((flagResult_ & 0x0F) == 0x0F) << kHalfCarryFlagBit);
+        break;
+      case FlagOp::BIT:
+        flags |= 0x1 << kHalfCarryFlagBit;
+        break;
+      case FlagOp::ADD:
+        flags |= ((flagA_ & 0x0F) + (flagB_ & 0x0F) > 0x0F)
+                 << kHalfCarryFlagBit;
+        break;
+      case FlagOp::SUB:
+        flags |= (0x1 << kAddSubFlagBit) |
+                 (((flagA_ & 0x0F) < (flagB_ & 0x0F)) << kHalfCarryFlagBit);
+        break;
+      default:
+        break;
+    }
+
+    af_[0] = flags;
+    flagOp_ = FlagOp::NONE;
+  }
+
   uint8_t af_[2] = {0x00};  // accumulator and flags
   uint8_t bc_[2] = {0x00};
   uint8_t de_[2] = {0x00};
@@ -189,6 +279,12 @@ class Registers {
 
   uint16_t sp_ = 0x0000;  // stack pointer
   uint16_t pc_ = 0x0000;  // program counter
+
+  // flags not yet written to F
+  FlagOp flagOp_ = FlagOp::NONE;
+  uint8_t flagResult_ = 0;
+  uint8_t flagA_ = 0;
+  uint8_t flagB_ = 0;
 };
 
 constexpr const bool RegisterTypeIs16Bit(RegisterType type) {
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "gameboy.h"
+
+const size_t kRewindBufferSize = 16 * 1024 * 1024;
+const size_t kRewindMaxSnapshots = 1 << 15;
+// Frames between snapshots. Rewinding loads one snapshot and runs a frame
+// to show it per host frame, so history plays back this many times faster
+// than it was recorded.
+const uint32_t kRewindFrameInterval = 2;
+
+struct RewindEntry {
+  size_t offset = 0;
+  size_t size = 0;
+};
+
+// History of save states in a fixed amount of memory.
+//
+// Only the newest state is kept whole. Each older one is stored as the
+// run-length encoded XOR against the state after it, which is mostly zeros
+// since little of the machine changes in a few frames. Rewinding pops the
+// newest state and applies its delta to get the one before. Once the arena
+// is full the oldest deltas are overwritten.
+class RewindBuffer {
+ public:
+  RewindBuffer(const size_t capacity = kRewindBufferSize);
+  virtual ~RewindBuffer();
+
+  void Push(System& system);
+  bool Rewind(System& system);
+  void Clear();
+
+  size_t Snapshots() const;
+  size_t BytesUsed() const;
+  RewindEntry& Newest();
+  void Store(const size_t size);
+
+  std::vector<uint8_t> arena_;
+  std::vector<RewindEntry> entries_;  // ring of deltas, oldest at head_
+  size_t head_ = 0;
+  size_t count_ = 0;
+  size_t writeOffset_ = 0;
+
+  std::vector<uint8_t> current_;  // newest state, empty when there is none
+  std::vector<uint8_t> scratch_;  // state being pushed
+  std::vector<uint8_t> delta_;    // encoded before it is copied into the arena
+};
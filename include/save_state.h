@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+// "OSTR", followed by the version and a section count
+const uint32_t kStateMagic = 0x5254534F;
+const uint16_t kStateVersion = 1;
+
+// Each component writes its own section as an id and size followed by its
+// fields in native byte order, so states only load on the build that made
+// them. Bump the version whenever a section's layout changes.
+enum class StateSection : uint32_t {
+  SYSTEM,     // which cartridge the state belongs to
+  CPU,
+  TIMER,
+  IO,
+  PPU,        // registers, pixel pipeline, OAM and VRAM
+  MEMORY,     // WRAM and HRAM
+  SCHEDULER,
+  CART,       // mapper registers and RTC
+  CART_RAM,
+};
+
+const uint32_t kStateSectionCount = 9;
+
+class StateWriter {
+ public:
+  StateWriter(std::vector<uint8_t>& buffer);
+  virtual ~StateWriter();
+
+  void BeginSection(const StateSection section);
+  void EndSection();
+  void WriteBytes(const void* data, const size_t size);
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable values can be written");
+    WriteBytes(&value, sizeof(T));
+  }
+
+  std::vector<uint8_t>& buffer_;
+  size_t sectionStart_ = 0;
+  uint16_t sectionCount_ = 0;
+};
+
+// Reads fail rather than run past the end of their section, and a failed
+// read leaves the destination untouched.
+class StateReader {
+ public:
+  StateReader(const std::vector<uint8_t>& buffer);
+  virtual ~StateReader();
+
+  bool BeginSection(const StateSection section);
+  uint32_t SectionSize(const StateSection section);
+  bool ReadBytes(void* data, const size_t size);
+  const uint8_t* ReadSpan(const size_t size);
+
+  template <typename T>
+  bool Read(T& value) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "only trivially copyable values can be read");
+    return ReadBytes(&value, sizeof(T));
+  }
+
+  const std::vector<uint8_t>& buffer_;
+  bool valid_ = false;  // header and section table are well formed
+  bool failed_ = false;
+  size_t position_ = 0;
+  size_t sectionEnd_ = 0;
+  std::array<size_t, kStateSectionCount> offsets_ = {};
+  std::array<uint32_t, kStateSectionCount> sizes_ = {};
+  std::array<bool, kStateSectionCount> present_ = {};
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "interface/event_handler.h"
+#include "save_state.h"
+
+const uint64_t kSchedulerNever = UINT64_MAX;
+
+// Master clock and pending events for everything outside the CPU.
+//
+// The frontend advances now_ after each CPU step and only calls RunEvents
+// once it reaches nextEvent_. Components keep track of how far they've been
+// synced and catch up when their event fires or their registers are
+// accessed, so nothing has to run for the cycles in between.
+class Scheduler {
+ public:
+  Scheduler();
+  virtual ~Scheduler();
+
+  void Schedule(const EventType type, const uint64_t time);
+  void Cancel(const EventType type);
+  void RunEvents();
+  void UpdateNextEvent();
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
+
+  uint64_t now_ = 0;  // t-cycles since power on
+  uint64_t nextEvent_ = kSchedulerNever;
+
+  std::array<uint64_t, kEventTypeCount> events_;
+  // not owned, the frontend keeps its FRAME_END handler alive itself
+  std::array<EventHandler*, kEventTypeCount> handlers_ = {};
+};
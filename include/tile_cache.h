@@ -0,0 +1,35 @@
+#pragma once
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+
+const uint32_t kTileCount = 384;  // 0x8000-0x97FF
+const uint16_t kTileDataSize = kTileCount * 16;
+
+// one row of 8 pixels as color indices, leftmost pixel first
+using TileRow = std::array<uint8_t, 8>;
+
+struct DecodedTile {
+  std::array<TileRow, 8> rows;
+  std::array<TileRow, 8> flippedRows;  // mirrored for X-flipped sprites
+};
+
+// Tile data decoded from the 2bpp planar format in VRAM. Writes mark the
+// tile they land in dirty and it's only decoded again the next time a row
+// of it is used.
+class TileCache {
+ public:
+  TileCache();
+  virtual ~TileCache();
+
+  const TileRow& Row(const std::vector<uint8_t>& vram, const uint16_t offset,
+                     const bool xFlip);
+  void Invalidate(const uint16_t offset);
+  void InvalidateAll();
+  void Decode(const std::vector<uint8_t>& vram, const uint16_t tile);
+
+  std::vector<DecodedTile> tiles_ = std::vector<DecodedTile>(kTileCount);
+  std::bitset<kTileCount> dirty_;
+};
@@ -1,25 +1,46 @@
 #pragma once
 
 #include <cstdint>
-#include <memory>
 
 #include "interface/addressable.h"
-#include "interface/interrupt_handler.h"
+#include "interface/event_handler.h"
+#include "save_state.h"
+#include "scheduler.h"
 
-class Timer : public Addressable {
+class CPU;
+
+// DIV's t-cycle bit that TIMA counts falling edges of, selected by TAC
+const uint8_t kTimerClockBits[4] = {9, 3, 5, 7};
+const uint8_t kTimerEnable = 0b0100;
+
+// Nothing here runs per cycle. The internal counter behind DIV is the master
+// clock plus an offset, and TIMA is brought up to date by counting how many
+// falling edges of the selected counter bit happened since the last sync, so
+// it can't run without the scheduler that clock comes from.
+class Timer final : public Addressable, public EventHandler {
  public:
-  Timer();
+  Timer(Scheduler& scheduler);
   virtual ~Timer();
 
   const uint8_t Read(const uint16_t addr);
   void Write(const uint16_t addr, const uint8_t value);
+  void SaveState(StateWriter& state);
+  void LoadState(StateReader& state);
 
-  void Tick();
+  void HandleEvent(const EventType type);
+  void Sync();
+  void ScheduleEvents();
+  uint64_t CyclesUntilOverflow();
+  uint64_t Counter();
+  bool TimaInput();
+  void IncrementTima(uint64_t increments);
 
-  std::shared_ptr<InterruptHandler> interruptHandler_ = nullptr;
+  CPU* cpu_ = nullptr;
+  Scheduler& scheduler_;
+  uint64_t lastSync_ = 0;  // master clock TIMA has been updated up to
 
-  uint16_t div_ = 0xAC00;  // 0xFF04, sort of
-  uint8_t tima_;           // 0xFF05
-  uint8_t tma_;            // 0xFF06
-  uint8_t tac_;            // 0xFF07
+  uint64_t counterOffset_ = 0xAC00;  // counter minus master clock, 0xFF04
+  uint8_t tima_;                     // 0xFF05
+  uint8_t tma_;                      // 0xFF06
+  uint8_t tac_;                      // 0xFF07
 };
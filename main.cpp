@@ -1,8 +1,12 @@
+#include <algorithm>
 #include <atomic>
-#include <chrono>
-#include <cmath>
+#include <cctype>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -11,13 +15,11 @@
 
 #include "SDL2/SDL.h"
 #include "SDL_timer.h"
-#include "address_bus.h"
 #include "cart.h"
-#include "cpu.h"
-#include "io.h"
-#include "ppu.h"
+#include "frame_pacer.h"
+#include "gameboy.h"
+#include "rewind.h"
 #include "spdlog/spdlog.h"
-#include "timer.h"
 
 const std::string kSaveExtension = ".sav";
 
@@ -26,12 +28,20 @@ std::string message = "";
 SDL_Window* sdlWindow;
 SDL_Renderer* sdlRenderer;
 SDL_Texture* sdlTexture;
-SDL_Surface* sdlScreen;
 
 const int scale = 8;  // TODO make configurable
-const float targetMsPerFrame = (100.0) / 6.0;
+// only bounds how long a quit from the emulation thread goes unnoticed
+const int kEventTimeoutMs = 250;
+// every frame run ahead is emulated again each host frame
+const uint32_t kMaxRunAhead = 8;
 
 std::atomic<bool> quit{false};
+uint64_t presentedSequence = 0;
+std::atomic<bool> rewinding{false};
+std::atomic<bool> fastForward{false};
+std::atomic<float> speed{0};  // measured over a second, 1.0 is full speed
+Uint32 frameReadyEvent;
+std::atomic<bool> frameReadyQueued{false};
 
 void initWindow() {
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
@@ -39,41 +49,43 @@ void initWindow() {
     exit(-1);
   }
 
-  SDL_CreateWindowAndRenderer(kLCDWidth * scale, kLCDHeight * scale, 0,
-                              &sdlWindow, &sdlRenderer);
-  sdlScreen =
-      SDL_CreateRGBSurface(0, kLCDWidth * scale, kLCDHeight * scale, 32,
-                           0, 0, 0, 0);
+  // whole-pixel scaling of the native frame, letterboxed to keep its shape
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+  SDL_CreateWindowAndRenderer(kLCDWidth * scale, kLCDHeight * scale,
+                              SDL_WINDOW_RESIZABLE, &sdlWindow, &sdlRenderer);
+  SDL_RenderSetLogicalSize(sdlRenderer, kLCDWidth, kLCDHeight);
+  SDL_RenderSetIntegerScale(sdlRenderer, SDL_TRUE);
   sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_ARGB8888,
-                                 SDL_TEXTUREACCESS_STREAMING, kLCDWidth * scale,
-                                 kLCDHeight * scale);
+                                 SDL_TEXTUREACCESS_STREAMING, kLCDWidth,
+                                 kLCDHeight);
 }
 
-void updateWindow(std::shared_ptr<PPU> ppu) {
-  SDL_Rect rect;
-  rect.x = rect.y = 0;
-  rect.w = sdlScreen->w;
-  rect.h = sdlScreen->h;
-
-  // mimic how the ppu updates - left-to-right line-by-line
-  for (int y = 0; y < kLCDHeight; y++) {
-    for (int x = 0; x < kLCDWidth; x++) {
-      rect.x = x * scale;
-      rect.y = y * scale;
-      rect.w = scale;
-      rect.h = scale;
-
-      SDL_FillRect(sdlScreen, &rect, ppu->screenBuffer_[x + (y * 160)]);
+void updateWindow(PPU& ppu) {
+  // only whole frames are drawn, and only once
+  uint64_t sequence = ppu.frameBuffers_.Acquire();
+  if (sequence == presentedSequence) {
+    return;
+  }
+  presentedSequence = sequence;
+  const uint32_t* frame = ppu.frameBuffers_.Front();
+
+  // the renderer scales the 160x144 texture up
+  void* pixels;
+  int pitch;
+  if (SDL_LockTexture(sdlTexture, nullptr, &pixels, &pitch) == 0) {
+    for (uint32_t y = 0; y < kLCDHeight; y++) {
+      std::memcpy(static_cast<uint8_t*>(pixels) + y * pitch,
+                  frame + y * kLCDWidth, kLCDWidth * sizeof(uint32_t));
     }
+    SDL_UnlockTexture(sdlTexture);
   }
 
-  SDL_UpdateTexture(sdlTexture, nullptr, sdlScreen->pixels, sdlScreen->pitch);
   SDL_RenderClear(sdlRenderer);
   SDL_RenderCopy(sdlRenderer, sdlTexture, nullptr, nullptr);
   SDL_RenderPresent(sdlRenderer);
 }
 
-void handleKeyPress(SDL_Event e, std::shared_ptr<IO> io) {
+void handleKeyPress(SDL_Event e, IO& io) {
   SDL_KeyboardEvent keyEvent = e.key;
 
   bool pressed = !(keyEvent.type == SDL_KEYUP);
@@ -88,37 +100,58 @@ void handleKeyPress(SDL_Event e, std::shared_ptr<IO> io) {
     /* case SDLK_DOWN: io->UpdateJoypad(kIOStartDown, pressed); break; */
     /* case SDLK_UP: io->UpdateJoypad(kIOSelectUp, pressed); break; */
     case SDLK_z:
-      io->a_ = pressed;
+      io.a_ = pressed;
       break;
     case SDLK_x:
-      io->b_ = pressed;
+      io.b_ = pressed;
       break;
     case SDLK_a:
-      io->start_ = pressed;
+      io.start_ = pressed;
       break;
     case SDLK_s:
-      io->select_ = pressed;
+      io.select_ = pressed;
       break;
     case SDLK_LEFT:
-      io->left_ = pressed;
+      io.left_ = pressed;
       break;
     case SDLK_RIGHT:
-      io->right_ = pressed;
+      io.right_ = pressed;
       break;
     case SDLK_UP:
-      io->up_ = pressed;
+      io.up_ = pressed;
       break;
     case SDLK_DOWN:
-      io->down_ = pressed;
+      io.down_ = pressed;
+      break;
+    case SDLK_BACKSPACE:
+      rewinding = pressed;
+      break;
+    case SDLK_TAB:
+      fastForward = pressed;
       break;
     default:
       spdlog::warn("Unmapped key pressed: {}", keyEvent.keysym.sym);
   }
 }
 
-void handleWindowEvents(std::shared_ptr<IO> io) {
-  SDL_Event e;
-  while (SDL_PollEvent(&e) > 0) {
+// Wakes the main thread for a newly published frame. At most one is
+// queued, so fast-forwarding can't flood the event queue, and the flag is
+// cleared before the frame is acquired so none can be missed.
+void notifyFrameReady() {
+  if (!frameReadyQueued.exchange(true)) {
+    SDL_Event e = {};
+    e.type = frameReadyEvent;
+    SDL_PushEvent(&e);
+  }
+}
+
+void handleWindowEvents(SDL_Event& e, IO& io) {
+  do {
+    if (e.type == frameReadyEvent) {
+      frameReadyQueued = false;
+      continue;
+    }
+
     switch (e.type) {
       case SDL_QUIT:
         quit = true;
@@ -126,72 +159,109 @@ void handleWindowEvents(std::shared_ptr<IO> io) {
       case SDL_WINDOWEVENT:
         if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
           quit = true;
+        } else if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          presentedSequence = 0;  // redraw at the new size
         }
+        break;
       case SDL_KEYDOWN:
       case SDL_KEYUP:
         handleKeyPress(e, io);
       default:
         break;
     }
-  }
+  } while (SDL_PollEvent(&e) > 0);
 }
 
-void updateSerialDebugMessage(std::shared_ptr<IO> io) {
-  if (io->serialControl_ == 0x81) {
-    message += io->serialData_;
+void updateSerialDebugMessage(IO& io) {
+  if (io.serialControl_ == 0x81) {
+    message += io.serialData_;
 
-    io->serialControl_ = 0x00;
+    io.serialControl_ = 0x00;
   }
 }
 
-void runGameboy(std::shared_ptr<CPU> cpu, std::shared_ptr<Timer> timer,
-                std::shared_ptr<PPU> ppu) {
-  uint32_t lastCycles = 0;
-  uint32_t lastFrameCount = 0;
-  uint64_t frameStartTime = SDL_GetPerformanceCounter();
-  uint32_t measureFrames = 0;
-  uint64_t measureStart = frameStartTime;
+// paces frames as the ppu finishes them, unless fast-forwarding, and
+// reports the speed and frame times once a second
+class FrameLimiter : public EventHandler {
+ public:
+  FrameLimiter(FrameBuffers& frameBuffers) : frameBuffers(frameBuffers) {}
+
+  void HandleEvent(const EventType /*type*/) {
+    // before pacing, so the frame is shown as soon as it's done
+    if (frameBuffers.published_ != notifiedFrame) {
+      notifiedFrame = frameBuffers.published_;
+      notifyFrameReady();
+    }
 
-  while (!quit) {
-    if (cpu->Step() < 0) {
-      std::cout << "Error in CPU step\n";
-      break;
+    if (fastForward) {
+      fastForwarding = true;
+    } else {
+      // the deadlines were left behind while running uncapped
+      if (fastForwarding) {
+        pacer.Reset();
+        fastForwarding = false;
+      }
+      pacer.Wait();
     }
 
-    int elapsed = cpu->cycles_ - lastCycles;
-    // timer ticks 4 times every m cycle
-    for (int i = 0; i < 4 * elapsed; i++) {
-      timer->Tick();
-      ppu->Tick();
-
-      // todo convert to callback in ppu
-      if (ppu->frames_ != lastFrameCount) {
-        uint64_t frameEndTime = SDL_GetPerformanceCounter();
-        float elapsedMs = (frameEndTime - frameStartTime) /
-                          (float)SDL_GetPerformanceFrequency() * 1000.0;
-
-        if (elapsedMs < targetMsPerFrame) {
-          std::this_thread::sleep_for(std::chrono::milliseconds(
-              (int)floor(targetMsPerFrame - elapsed)));
-        }
+    measureFrames++;
 
-        if ((frameEndTime - measureStart) /
-                (float)SDL_GetPerformanceFrequency() * 1000.0 >=
-            1000) {
-          spdlog::info("{} frames per second", measureFrames);
-          measureStart = frameEndTime;
-          measureFrames = 0;
-        }
+    uint64_t now = SDL_GetPerformanceCounter();
+    double measuredSeconds =
+        (now - measureStart) / (double)SDL_GetPerformanceFrequency();
+    if (measuredSeconds >= 1) {
+      speed = measureFrames / measuredSeconds / kGameBoyFrameRate;
 
-        measureFrames++;
+      FramePacerStats stats = pacer.TakeStats();
+      spdlog::info(
+          "{} frames per second, frame time {:.3f} ms (jitter {:.3f} ms, "
+          "{:.3f}-{:.3f} ms), {} late",
+          measureFrames, stats.meanMs, stats.jitterMs, stats.minMs,
+          stats.maxMs, stats.late);
 
-        // reset for next frame
-        frameStartTime = SDL_GetPerformanceCounter();
-        lastFrameCount = ppu->frames_;
-      }
+      measureStart = now;
+      measureFrames = 0;
+    }
+  }
+
+  FrameBuffers& frameBuffers;
+  uint64_t notifiedFrame = 0;
+  FramePacer pacer;
+  bool fastForwarding = false;
+  uint32_t measureFrames = 0;
+  uint64_t measureStart = SDL_GetPerformanceCounter();
+};
+
+void runGameboy(System& gameboy, const uint32_t runAhead) {
+  RewindBuffer rewind;
+  uint32_t frames = 0;
+  uint64_t lastRendered = 0;
+  uint64_t ticksPerFrame = SDL_GetPerformanceFrequency() / kGameBoyFrameRate;
+
+  while (!quit) {
+    // when fast-forwarding, only draw frames the window could show. The
+    // rest keep their timing and interrupts but skip the pixel work
+    uint64_t now = SDL_GetPerformanceCounter();
+    gameboy.ppu_.skipRender_ =
+        fastForward && now - lastRendered < ticksPerFrame;
+    if (!gameboy.ppu_.skipRender_) {
+      lastRendered = now;
     }
 
-    lastCycles = cpu->cycles_;
+    // a snapshot is shown by running the frame after it
+    if (rewinding) {
+      rewind.Rewind(gameboy);
+    }
+
+    bool ok = rewinding ? gameboy.RunFrame() : gameboy.RunAhead(runAhead);
+    if (!ok) {
+      std::cout << "Error in CPU step\n";
+      break;
+    }
+
+    if (!rewinding && ++frames % kRewindFrameInterval == 0) {
+      rewind.Push(gameboy);
+    }
 
     /* updateSerialDebugMessage(io); */
     /* if (message.length() > 0) { */
@@ -209,40 +279,99 @@ int main(int argc, char** argv) {
     return -1;
   }
   std::string filename(argv[1]);
-  std::shared_ptr<Cart> cart = CreateCartridge(filename);
-  std::cout << cart->Describe() << "\n";
+
+  // optional flags after the rom
+  bool useJit = false;
+  bool perfMap = false;
+  bool scanline = false;
+  bool lockstep = false;
+  bool syncDisplay = false;
+  uint32_t runAhead = 0;
+  for (int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg == "--jit") {
+      useJit = true;
+    } else if (arg == "--perf-map") {
+      perfMap = true;
+    } else if (arg == "--scanline") {
+      scanline = true;
+    } else if (arg == "--lockstep") {
+      lockstep = true;
+    } else if (arg == "--sync-display") {
+      syncDisplay = true;
+    } else if (arg == "--fast-forward") {
+      fastForward = true;
+    } else if (arg == "--run-ahead") {
+      // frames to show ahead of the real one, 1 or 2 covers most games
+      const char* value = i + 1 < argc ? argv[++i] : "";
+      char* end = nullptr;
+      unsigned long frames = std::strtoul(value, &end, 10);
+      if (!std::isdigit(static_cast<unsigned char>(value[0])) || *end != '\0') {
+        std::cout << "Enter a number of frames for --run-ahead\n";
+        return -1;
+      }
+
+      if (frames > kMaxRunAhead) {
+        std::cout << "Running at most " << kMaxRunAhead << " frames ahead\n";
+      }
+      runAhead = std::min<unsigned long>(frames, kMaxRunAhead);
+    }
+  }
+
+  std::unique_ptr<System> gameboy = CreateGameBoy(filename);
+  if (!gameboy) {
+    return -1;
+  }
+
+  Cart& cart = gameboy->GetCart();
+  std::cout << cart.Describe() << "\n";
 
   if (std::filesystem::exists(filename + kSaveExtension)) {
     std::cout << "Loading save file\n";
     LoadCartridge(cart, filename + kSaveExtension);
   }
 
-  std::shared_ptr<AddressBus> addressBus = std::make_shared<AddressBus>();
-  std::shared_ptr<CPU> cpu = std::make_shared<CPU>();
-  std::shared_ptr<Timer> timer = std::make_shared<Timer>();
-  std::shared_ptr<IO> io = std::make_shared<IO>();
-  std::shared_ptr<PPU> ppu = std::make_shared<PPU>();
-
-  // connect up components
-  cpu->memory_ = addressBus;
-  addressBus->cart_ = cart;
-  addressBus->io_ = io;
-  addressBus->ppu_ = ppu;
-  io->timer_ = timer;
-  io->cpu_ = cpu;
-  io->ppu_ = ppu;
-  timer->interruptHandler_ = cpu;
-  ppu->memory_ = addressBus;
-  ppu->interruptHandler_ = cpu;
+  gameboy->ppu_.scanline_ = scanline;
+  gameboy->SetPPUCatchUp(!lockstep);
+  FrameLimiter limiter(gameboy->ppu_.frameBuffers_);
+  gameboy->scheduler_.handlers_[(int)EventType::FRAME_END] = &limiter;
+
+#ifdef OSTRICH_JIT
+  if (useJit) {
+    gameboy->EnableJit(perfMap);
+  }
+#endif
 
   initWindow();
+  frameReadyEvent = SDL_RegisterEvents(1);
+
+  // run at the display's rate instead, about 0.5% fast on a 60 Hz screen,
+  // so frames don't drift against its refreshes
+  SDL_DisplayMode mode;
+  if (syncDisplay && SDL_GetCurrentDisplayMode(0, &mode) == 0 &&
+      mode.refresh_rate > 0) {
+    limiter.pacer.SetRate(mode.refresh_rate);
+    limiter.pacer.Reset();
+  }
 
-  std::thread t1(runGameboy, cpu, timer, ppu);
+  std::thread t1(runGameboy, std::ref(*gameboy), runAhead);
 
-  uint32_t lastCycles_ = 0;
+  float shownSpeed = 0;
   while (!quit) {
-    updateWindow(ppu);
-    handleWindowEvents(io);
+    // sleeps until there is input or a new frame to show
+    SDL_Event e;
+    if (SDL_WaitEventTimeout(&e, kEventTimeoutMs)) {
+      handleWindowEvents(e, gameboy->io_);
+    }
+
+    updateWindow(gameboy->ppu_);
+
+    if (speed != shownSpeed) {
+      shownSpeed = speed;
+      char title[64];
+      snprintf(title, sizeof(title), "gb_ostrich - %.1fx", shownSpeed);
+      SDL_SetWindowTitle(sdlWindow, title);
+    }
   }
 
   t1.join();
@@ -1,26 +1,45 @@
 #include "address_bus.h"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
-AddressBus::AddressBus() {}
+#include "cart/mbc1.h"
+#include "cart/mbc3.h"
+
+AddressBus::AddressBus() {
+  memoryMap_.MapWritable(kWramStart, kWramEnd, wram_.data());
+}
 
 AddressBus::~AddressBus() {}
 
-const uint8_t AddressBus::Read(const uint16_t addr) {
+template <typename Mapper>
+CartBus<Mapper>::CartBus(Mapper& cart) : cart_(cart) {}
+
+template <typename Mapper>
+CartBus<Mapper>::~CartBus() {}
+
+// cartridge calls are qualified so they're direct even when the mapper is
+// the plain Cart other mappers derive from
+template <typename Mapper>
+const uint8_t CartBus<Mapper>::ReadUnmapped(const uint16_t addr) {
+  // hram shares its page with io
+  if (addr >= kHramStart && addr <= kHramEnd) {
+    return hram_[addr - kHramStart];
+  }
+
   if (addr >= kRomBankStart && addr <= kRomBankEnd) {
-    return cart_->Read(addr);
+    return cart_.Mapper::Read(addr);
   } else if (addr >= kVramStart && addr <= kVramEnd) {
     return ppu_->Read(addr);
   } else if (addr >= kExternalRamStart && addr <= kExternalRamEnd) {
-    return cart_->Read(addr);
+    return cart_.Mapper::Read(addr);
   } else if (addr >= kWramStart && addr <= kWramEnd) {
     return wram_[addr - kWramStart];
   } else if (addr >= kOamStart && addr <= kOamEnd) {
     return ppu_->Read(addr);
   } else if (addr >= kIoStart && addr <= kIoEnd) {
     return io_->Read(addr);
-  } else if (addr >= kHramStart && addr <= kHramEnd) {
-    return hram_[addr - kHramStart];
   } else if (addr == kInterruptFlags) {
     return io_->Read(addr);
   } else if (addr == kInterruptEnable) {
@@ -31,21 +50,39 @@ const uint8_t AddressBus::Read(const uint16_t addr) {
   return 0xFF;
 }
 
-void AddressBus::Write(const uint16_t addr, const uint8_t value) {
+template <typename Mapper>
+void CartBus<Mapper>::WriteUnmapped(const uint16_t addr, const uint8_t value) {
+  if (addr >= kHramStart && addr <= kHramEnd) {
+    hram_[addr - kHramStart] = value;
+
+    if (decodeCache_) {
+      decodeCache_->Invalidate(addr);
+    }
+    return;
+  }
+
   if (addr >= kRomBankStart && addr <= kRomBankEnd) {
-    cart_->Write(addr, value);
+    cart_.Mapper::Write(addr, value);
+    cart_.Mapper::MapRom(memoryMap_);
+
+    // writes here only ever change the cartridge's bank registers
+    if (decodeCache_) {
+      decodeCache_->SelectRomBank(cart_.Mapper::RomBank());
+    }
   } else if (addr >= kVramStart && addr <= kVramEnd) {
     ppu_->Write(addr, value);
   } else if (addr >= kExternalRamStart && addr <= kExternalRamEnd) {
-    cart_->Write(addr, value);
+    cart_.Mapper::Write(addr, value);
   } else if (addr >= kWramStart && addr <= kWramEnd) {
     wram_[addr - kWramStart] = value;
+
+    if (decodeCache_) {
+      decodeCache_->Invalidate(addr);
+    }
   } else if (addr >= kOamStart && addr <= kOamEnd) {
     ppu_->Write(addr, value);
   } else if (addr >= kIoStart && addr <= kIoEnd) {
     io_->Write(addr, value);
-  } else if (addr >= kHramStart && addr <= kHramEnd) {
-    hram_[addr - kHramStart] = value;
   } else if (addr == kInterruptFlags) {
     io_->Write(addr, value);
   } else if (addr == kInterruptEnable) {
@@ -54,3 +91,57 @@ void AddressBus::Write(const uint16_t addr, const uint8_t value) {
     std::cout << "Unimplemented memory write: " << std::hex << addr << "\n";
   }
 }
+
+// called once everything is connected, the cart keeps its own pages up to
+// date after that as its bank registers are written
+template <typename Mapper>
+void CartBus<Mapper>::MapMemory() {
+  cart_.Mapper::MapRom(memoryMap_);
+
+  // the ppu doesn't need to catch up for vram reads, it never writes there
+  if (ppu_) {
+    memoryMap_.Map(kVramStart, kVramEnd, ppu_->vram_.data());
+  }
+}
+
+void AddressBus::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::MEMORY);
+  state.WriteBytes(wram_.data(), wram_.size());
+  state.WriteBytes(hram_.data(), hram_.size());
+  state.EndSection();
+}
+
+void AddressBus::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::MEMORY);
+  LoadRam(state, wram_, kWramStart);
+  LoadRam(state, hram_, kHramStart);
+}
+
+// Only chunks that differ are copied, and only code decoded from those is
+// invalidated. Restoring a checkpoint usually touches little of WRAM, and
+// clearing the whole decode cache would cost more than copying the memory.
+void AddressBus::LoadRam(StateReader& state, std::vector<uint8_t>& ram,
+                         const uint16_t start) {
+  const uint8_t* saved = state.ReadSpan(ram.size());
+  if (saved == nullptr) {
+    return;
+  }
+
+  for (size_t chunk = 0; chunk < ram.size(); chunk += kRamLoadChunk) {
+    size_t size = std::min<size_t>(kRamLoadChunk, ram.size() - chunk);
+    if (std::memcmp(&ram[chunk], saved + chunk, size) == 0) {
+      continue;
+    }
+
+    std::memcpy(&ram[chunk], saved + chunk, size);
+    if (decodeCache_) {
+      for (size_t i = 0; i < size; i++) {
+        decodeCache_->Invalidate(start + chunk + i);
+      }
+    }
+  }
+}
+
+template class CartBus<Cart>;
+template class CartBus<MBC1Cart>;
+template class CartBus<MBC3Cart>;
@@ -80,8 +80,32 @@ void Cart::Write(uint16_t addr, uint8_t value) {
   /* buffer_[i] = byte; */
 }
 
+// the bank currently mapped into 0x4000-0x7FFF
+uint16_t Cart::RomBank() { return 1; }
+
+// points the rom pages at the banks currently selected, or leaves them to
+// Read if the rom is too small to hold them
+void Cart::MapRom(MemoryMap& memoryMap) {
+  if (buffer_.size() >= 0x8000) {
+    memoryMap.Map(0x0000, 0x7FFF, buffer_.data());
+  } else {
+    memoryMap.Unmap(0x0000, 0x7FFF);
+  }
+}
+
 std::vector<uint8_t> Cart::Save() { return ram_; }
 
 void Cart::Load(const std::vector<uint8_t> saveData) {
   ram_ = std::vector<uint8_t>(saveData);
-}
\ No newline at end of file
+}
+
+void Cart::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::CART_RAM);
+  state.WriteBytes(ram_.data(), ram_.size());
+  state.EndSection();
+}
+
+void Cart::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::CART_RAM);
+  state.ReadBytes(ram_.data(), ram_.size());
+}
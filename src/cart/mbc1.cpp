@@ -48,6 +48,26 @@ void MBC1Cart::Write(uint16_t addr, uint8_t value) {
   }
 }
 
+uint16_t MBC1Cart::RomBank() {
+  if (romBankNumber_ <= 0x01) {  // 0x00 or 0x01 selects rom bank 1
+    return 1;
+  }
+
+  return romBankNumber_;
+}
+
+void MBC1Cart::MapRom(MemoryMap& memoryMap) {
+  uint32_t bankOffset = RomBank() * kMbc1RomBankSwitchableStart;
+
+  if (buffer_.size() >= bankOffset + kMbc1RomBankSwitchableStart) {
+    memoryMap.Map(kMbc1RomBankX0Start, kMbc1RomBankX0End, buffer_.data());
+    memoryMap.Map(kMbc1RomBankSwitchableStart, kMbc1RomBankSwitchableEnd,
+                  buffer_.data() + bankOffset);
+  } else {
+    memoryMap.Unmap(kMbc1RomBankX0Start, kMbc1RomBankSwitchableEnd);
+  }
+}
+
 const uint8_t MBC1Cart::ReadRomBank(const uint16_t addr) {
   if (romBankNumber_ <= 0x01) {  // 0x00 or 0x01 selects rom bank 1
     return buffer_[addr];
@@ -72,4 +92,25 @@ const uint8_t MBC1Cart::WriteRamBank(const uint16_t addr, const uint8_t value) {
     ram_[ramIndex] = value;
   }
   return 0xFF;
-}
\ No newline at end of file
+}
+
+void MBC1Cart::SaveState(StateWriter& state) {
+  Cart::SaveState(state);
+
+  state.BeginSection(StateSection::CART);
+  state.Write(ramEnable_);
+  state.Write(romBankNumber_);
+  state.Write(ramBankNumber_);
+  state.Write(bankingModeSelect_);
+  state.EndSection();
+}
+
+void MBC1Cart::LoadState(StateReader& state) {
+  Cart::LoadState(state);
+
+  state.BeginSection(StateSection::CART);
+  state.Read(ramEnable_);
+  state.Read(romBankNumber_);
+  state.Read(ramBankNumber_);
+  state.Read(bankingModeSelect_);
+}
@@ -55,6 +55,26 @@ void MBC3Cart::Write(uint16_t addr, uint8_t value) {
   }
 }
 
+uint16_t MBC3Cart::RomBank() {
+  if (romBankNumber_ <= 0x01) {  // 0x00 or 0x01 selects rom bank 1
+    return 1;
+  }
+
+  return romBankNumber_;
+}
+
+void MBC3Cart::MapRom(MemoryMap& memoryMap) {
+  uint32_t bankOffset = RomBank() * kMbc3RomBankSwitchableStart;
+
+  if (buffer_.size() >= bankOffset + kMbc3RomBankSwitchableStart) {
+    memoryMap.Map(kMbc3RomBank00Start, kMbc3RomBank00End, buffer_.data());
+    memoryMap.Map(kMbc3RomBankSwitchableStart, kMbc3RomBankSwitchableEnd,
+                  buffer_.data() + bankOffset);
+  } else {
+    memoryMap.Unmap(kMbc3RomBank00Start, kMbc3RomBankSwitchableEnd);
+  }
+}
+
 const uint8_t MBC3Cart::ReadRomBank(const uint16_t addr) {
   if (romBankNumber_ <= 0x01) {  // 0x00 or 0x01 selects rom bank 1
     return buffer_[addr];
@@ -137,4 +157,41 @@ void MBC3Cart::LatchRTC() {
   // TODO carry
 }
 
-bool MBC3Cart::Halted() { return rtcDH_ & (0x01 << 6); }
\ No newline at end of file
+bool MBC3Cart::Halted() { return rtcDH_ & (0x01 << 6); }
+
+void MBC3Cart::SaveState(StateWriter& state) {
+  Cart::SaveState(state);
+
+  state.BeginSection(StateSection::CART);
+  state.Write(ramAndTimerEnable_);
+  state.Write(romBankNumber_);
+  state.Write(ramBankNumber_);
+  state.Write(bankingModeSelect_);
+  state.Write(latchClockData_);
+  state.Write(rtcS_);
+  state.Write(rtcM_);
+  state.Write(rtcH_);
+  state.Write(rtcDL_);
+  state.Write(rtcDH_);
+  state.Write(lastMeasuredMs_);
+  state.Write(elapsedMs_);
+  state.EndSection();
+}
+
+void MBC3Cart::LoadState(StateReader& state) {
+  Cart::LoadState(state);
+
+  state.BeginSection(StateSection::CART);
+  state.Read(ramAndTimerEnable_);
+  state.Read(romBankNumber_);
+  state.Read(ramBankNumber_);
+  state.Read(bankingModeSelect_);
+  state.Read(latchClockData_);
+  state.Read(rtcS_);
+  state.Read(rtcM_);
+  state.Read(rtcH_);
+  state.Read(rtcDL_);
+  state.Read(rtcDH_);
+  state.Read(lastMeasuredMs_);
+  state.Read(elapsedMs_);
+}
@@ -0,0 +1,417 @@
+#include "copy_loop.h"
+
+#include <algorithm>
+
+static RegisterType PairOf(const ArgumentType type) {
+  switch (type) {
+    case ArgumentType::BC:
+    case ArgumentType::MEM_AT_BC:
+      return RegisterType::BC;
+    case ArgumentType::DE:
+    case ArgumentType::MEM_AT_DE:
+      return RegisterType::DE;
+    case ArgumentType::HL:
+    case ArgumentType::MEM_AT_HL:
+    case ArgumentType::MEM_AT_HLI:
+    case ArgumentType::MEM_AT_HLD:
+      return RegisterType::HL;
+    default:
+      return RegisterType::NONE;
+  }
+}
+
+static RegisterType Register8(const ArgumentType type) {
+  switch (type) {
+    case ArgumentType::B:
+      return RegisterType::B;
+    case ArgumentType::C:
+      return RegisterType::C;
+    case ArgumentType::D:
+      return RegisterType::D;
+    case ArgumentType::E:
+      return RegisterType::E;
+    case ArgumentType::H:
+      return RegisterType::H;
+    case ArgumentType::L:
+      return RegisterType::L;
+    default:
+      return RegisterType::NONE;
+  }
+}
+
+static int PairIndex(const RegisterType pair) {
+  return static_cast<int>(pair) - static_cast<int>(RegisterType::BC);
+}
+
+// the pair an 8 bit register is half of, B and C are BC and so on
+static RegisterType PairContaining(const RegisterType reg) {
+  switch (reg) {
+    case RegisterType::B:
+    case RegisterType::C:
+      return RegisterType::BC;
+    case RegisterType::D:
+    case RegisterType::E:
+      return RegisterType::DE;
+    case RegisterType::H:
+    case RegisterType::L:
+      return RegisterType::HL;
+    default:
+      return reg;
+  }
+}
+
+// each address a pointer goes through over count iterations is in a page
+// of the given map
+template <typename T>
+static bool PagesMapped(const std::array<T*, kPageCount>& pages,
+                        const uint16_t first, const int step,
+                        const uint64_t count) {
+  int64_t last = first + int64_t(step) * int64_t(count - 1);
+  if (last < 0 || last > 0xFFFF) {
+    return false;
+  }
+
+  uint32_t low = std::min<int64_t>(first, last) / kPageSize;
+  uint32_t high = std::max<int64_t>(first, last) / kPageSize;
+  for (uint32_t page = low; page <= high; page++) {
+    if (pages[page] == nullptr) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool InVram(const uint16_t first, const int step,
+                   const uint64_t count) {
+  int64_t last = first + int64_t(step) * int64_t(count - 1);
+  return std::min<int64_t>(first, last) >= kVramStart &&
+         std::max<int64_t>(first, last) <= kVramEnd;
+}
+
+static DecodedInstruction DecodeAt(CPU& cpu, const uint16_t addr) {
+  DecodedInstruction* cached =
+      cpu.decodeCache_ ? cpu.decodeCache_->Find(addr) : nullptr;
+  if (cached != nullptr && cached->length != 0) {
+    return *cached;
+  }
+
+  return cpu.Decode(addr);
+}
+
+CopyLoopRunner::CopyLoopRunner() {}
+
+CopyLoopRunner::~CopyLoopRunner() {}
+
+// Called after a step that jumped back from `from` to the pc, returns the
+// m-cycles of the iterations that were run.
+uint64_t CopyLoopRunner::Run(CPU& cpu, AddressBus& bus, PPU& ppu,
+                             Scheduler& scheduler, const uint16_t from,
+                             const uint64_t until) {
+  Registers& registers = cpu.registers_;
+  uint16_t start = registers.ProgramCounter();
+
+  // only checked again once another loop runs, or its code has changed
+  if (!analyzed_ || loop_.start != start) {
+    loop_ = Analyze(cpu, start);
+    analyzed_ = true;
+
+    for (uint16_t i = 0; loop_.cycles != 0 && i < CodeSize(); i++) {
+      code_[i] = bus.Read(start + i);
+    }
+  }
+
+  const CopyLoop& loop = loop_;
+  if (loop.cycles == 0) {
+    return 0;
+  }
+
+  if (from < start || from > loop.branch) {
+    return 0;
+  }
+
+  // the jump back was taken, so the counter isn't 0 and the last
+  // iteration is left to the interpreter
+  uint64_t remaining = registers.Read(loop.counter);
+  bool copy = loop.source != RegisterType::NONE;
+  uint16_t source = registers.Read(loop.source) + loop.sourceOffset;
+  uint16_t destination =
+      registers.Read(loop.destination) + loop.destinationOffset;
+  int sourceStep = copy ? loop.steps[PairIndex(loop.source)] : 0;
+  int destinationStep = loop.steps[PairIndex(loop.destination)];
+
+  // the ppu reads vram as it draws, so writes there mustn't move past that
+  bool toVram = destination >= kVramStart && destination <= kVramEnd;
+  uint64_t end = std::min(scheduler.nextEvent_, until);
+  if (toVram) {
+    ppu.Sync();
+    end = std::min({end, scheduler.nextEvent_,
+                    ppu.lastSync_ + ppu.CyclesUntilVramRead()});
+  }
+
+  uint64_t iterations = remaining - 1;
+  if (end != kSchedulerNever) {
+    if (end <= scheduler.now_) {
+      return 0;
+    }
+    iterations =
+        std::min(iterations, (end - scheduler.now_) / (4 * loop.cycles));
+  }
+
+  if (iterations == 0 ||
+      (copy && !PagesMapped(bus.memoryMap_.read_, source, sourceStep,
+                            iterations)) ||
+      !(toVram ? InVram(destination, destinationStep, iterations)
+               : PagesMapped(bus.memoryMap_.write_, destination,
+                             destinationStep, iterations))) {
+    return 0;
+  }
+
+  // the code may be in ram, so it's only trusted once it's about to run
+  if (!CodeMatches(bus)) {
+    analyzed_ = false;
+    return 0;
+  }
+
+  uint8_t value = loop.fillZero ? 0 : registers.Read(loop.fill);
+  for (uint64_t i = 0; i < iterations; i++) {
+    if (copy) {
+      value = bus.memoryMap_.read_[source / kPageSize][source % kPageSize];
+      source += sourceStep;
+    }
+
+    // the same as the address bus does for each write
+    if (toVram) {
+      ppu.vram_[destination - kVramStart] = value;
+      ppu.tileCache_.Invalidate(destination - kVramStart);
+    } else {
+      bus.memoryMap_.write_[destination / kPageSize]
+                           [destination % kPageSize] = value;
+      if (bus.decodeCache_) {
+        bus.decodeCache_->Invalidate(destination);
+      }
+    }
+    destination += destinationStep;
+  }
+
+  // registers as the interpreter leaves them at the top of the loop
+  for (RegisterType pair :
+       {RegisterType::BC, RegisterType::DE, RegisterType::HL}) {
+    int step = loop.steps[PairIndex(pair)];
+    registers.Write(pair, registers.Read(pair) + step * iterations);
+  }
+
+  uint16_t counter = remaining - iterations;
+  registers.Write(loop.counter, counter);
+  if (RegisterTypeIs8Bit(loop.counter)) {
+    // Z and N are the same every time DEC r leaves the jump taken
+    registers.SetHalfCarryFlag((counter & 0x0F) == 0x0F);
+    if (copy) {
+      registers.A() = value;
+    }
+  } else {
+    // OR leaves the same flags every time it's nonzero
+    registers.A() = (counter >> 8) | (counter & 0xFF);
+  }
+
+  return iterations * loop.cycles;
+}
+
+// from the loop's start through its jump back
+uint16_t CopyLoopRunner::CodeSize() { return loop_.branch + 2 - loop_.start; }
+
+bool CopyLoopRunner::CodeMatches(AddressBus& bus) {
+  for (uint16_t i = 0; i < CodeSize(); i++) {
+    if (bus.Read(loop_.start + i) != code_[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Decodes from start up to the JR NZ back to it, matching a store of A
+// through one pointer and a counter at the end. Cycles are counted the way
+// the interpreter does, with the jump taken.
+CopyLoop CopyLoopRunner::Analyze(CPU& cpu, const uint16_t start) {
+  CopyLoop loop;
+  loop.start = start;
+
+  DecodedInstruction body[kCopyLoopMaxBytes];
+  size_t count = 0;
+  uint32_t cycles = 0;
+  uint16_t addr = start;
+
+  while (true) {
+    if (uint16_t(addr - start) >= kCopyLoopMaxBytes) {
+      return loop;
+    }
+
+    DecodedInstruction decoded = DecodeAt(cpu, addr);
+    const Instruction& instruction = kInstructions[decoded.opcode];
+    uint16_t next = addr + decoded.length;
+    cycles += decoded.length;
+
+    if (instruction.type == InstructionType::JR) {
+      if (instruction.condition != ConditionType::NZ ||
+          uint16_t(next + int8_t(decoded.operand)) != start) {
+        return loop;
+      }
+      loop.branch = addr;
+      cycles++;
+      break;
+    }
+
+    switch (instruction.type) {
+      case InstructionType::INC16:
+      case InstructionType::DEC16:
+        cycles++;
+        break;
+      case InstructionType::LD:
+        if (PairOf(instruction.source) != RegisterType::NONE ||
+            PairOf(instruction.destination) != RegisterType::NONE) {
+          cycles++;  // the memory access
+        }
+        break;
+      default:
+        break;
+    }
+
+    body[count++] = decoded;
+    addr = next;
+  }
+
+  // the counter's instructions end the body
+  auto is = [&](size_t i, InstructionType type) {
+    return kInstructions[body[i].opcode].type == type;
+  };
+  auto source = [&](size_t i) { return kInstructions[body[i].opcode].source; };
+
+  size_t bodyEnd = 0;
+  if (count >= 1 && is(count - 1, InstructionType::DEC) &&
+      Register8(source(count - 1)) != RegisterType::NONE) {
+    loop.counter = Register8(source(count - 1));
+    bodyEnd = count - 1;
+  } else if (count >= 3 && is(count - 3, InstructionType::DEC16) &&
+             is(count - 2, InstructionType::LD) &&
+             kInstructions[body[count - 2].opcode].destination ==
+                 ArgumentType::A &&
+             is(count - 1, InstructionType::OR)) {
+    RegisterType pair = PairOf(source(count - 3));
+    RegisterType high = Register8(source(count - 2));
+    RegisterType low = Register8(source(count - 1));
+    if (pair == RegisterType::NONE || high == low ||
+        PairContaining(high) != pair || PairContaining(low) != pair) {
+      return loop;
+    }
+    loop.counter = pair;
+    bodyEnd = count - 3;
+  } else {
+    return loop;
+  }
+
+  bool loaded = false;
+  bool stored = false;
+  bool setsA = false;
+
+  for (size_t i = 0; i < bodyEnd; i++) {
+    const Instruction& instruction = kInstructions[body[i].opcode];
+    RegisterType sourcePair = PairOf(instruction.source);
+    RegisterType destinationPair = PairOf(instruction.destination);
+
+    // (HL+) and (HL-) move HL after the access
+    int postStep = 0;
+    if (instruction.source == ArgumentType::MEM_AT_HLI ||
+        instruction.destination == ArgumentType::MEM_AT_HLI) {
+      postStep = 1;
+    } else if (instruction.source == ArgumentType::MEM_AT_HLD ||
+               instruction.destination == ArgumentType::MEM_AT_HLD) {
+      postStep = -1;
+    }
+
+    switch (instruction.type) {
+      case InstructionType::LD:
+        if (instruction.destination == ArgumentType::A &&
+            sourcePair != RegisterType::NONE &&
+            instruction.source != ArgumentType::HL) {
+          if (loaded || stored || setsA) {
+            return loop;
+          }
+          loop.source = sourcePair;
+          loop.sourceOffset = loop.steps[PairIndex(sourcePair)];
+          loop.steps[PairIndex(sourcePair)] += postStep;
+          loaded = true;
+        } else if (instruction.source == ArgumentType::A &&
+                   destinationPair != RegisterType::NONE) {
+          if (stored) {
+            return loop;
+          }
+          loop.destination = destinationPair;
+          loop.destinationOffset = loop.steps[PairIndex(destinationPair)];
+          loop.steps[PairIndex(destinationPair)] += postStep;
+          stored = true;
+        } else if (instruction.destination == ArgumentType::A &&
+                   Register8(instruction.source) != RegisterType::NONE) {
+          if (loaded || stored) {
+            return loop;
+          }
+          loop.fill = Register8(instruction.source);
+          loop.fillZero = false;
+          setsA = true;
+        } else {
+          return loop;
+        }
+        break;
+      case InstructionType::INC16:
+      case InstructionType::DEC16:
+        if (sourcePair == RegisterType::NONE) {
+          return loop;
+        }
+        loop.steps[PairIndex(sourcePair)] +=
+            instruction.type == InstructionType::INC16 ? 1 : -1;
+        break;
+      case InstructionType::XOR:
+        if (instruction.source != ArgumentType::A || loaded || stored) {
+          return loop;
+        }
+        loop.fill = RegisterType::NONE;
+        loop.fillZero = true;
+        setsA = true;
+        break;
+      default:
+        return loop;
+    }
+  }
+
+  if (!stored) {
+    return loop;
+  }
+
+  // A only keeps its value between iterations with an 8 bit counter
+  if (!loaded && !setsA) {
+    if (!RegisterTypeIs8Bit(loop.counter)) {
+      return loop;
+    }
+    loop.fill = RegisterType::A;
+  }
+
+  // the pointers, counter and filled value all have to be separate
+  RegisterType counterPair = PairContaining(loop.counter);
+  RegisterType fillPair = PairContaining(loop.fill);
+  if (loop.source == loop.destination || counterPair == loop.source ||
+      counterPair == loop.destination ||
+      loop.steps[PairIndex(counterPair)] != 0 ||
+      (fillPair != RegisterType::NONE && fillPair != RegisterType::A &&
+       (fillPair == counterPair || loop.steps[PairIndex(fillPair)] != 0))) {
+    return loop;
+  }
+
+  for (int step : loop.steps) {
+    if (step < -1 || step > 1) {
+      return loop;
+    }
+  }
+
+  loop.cycles = cycles;
+  return loop;
+}
@@ -1,7 +1,38 @@
 #include "cpu.h"
 
+#include <array>
+#include <utility>
+
 #include "spdlog/spdlog.h"
 
+template <size_t... opcodes>
+static constexpr std::array<OpcodeHandler, 256> MakeOpcodeHandlers(
+    std::index_sequence<opcodes...>) {
+  // unknown opcodes are left empty so Step can report them
+  return {{(kInstructions[opcodes].type == InstructionType::NONE
+                ? nullptr
+                : &CPU::_execute<opcodes>)...}};
+}
+
+template <size_t... cbOpcodes>
+static constexpr std::array<OpcodeHandler, 256> MakeCbOpcodeHandlers(
+    std::index_sequence<cbOpcodes...>) {
+  return {{&CPU::_executeCb<cbOpcodes>...}};
+}
+
+template <size_t... opcodes>
+static constexpr std::array<uint8_t, 256> MakeInstructionLengths(
+    std::index_sequence<opcodes...>) {
+  return {{InstructionLength(kInstructions[opcodes])...}};
+}
+
+static constexpr std::array<OpcodeHandler, 256> kOpcodeHandlers =
+    MakeOpcodeHandlers(std::make_index_sequence<256>{});
+static constexpr std::array<OpcodeHandler, 256> kCbOpcodeHandlers =
+    MakeCbOpcodeHandlers(std::make_index_sequence<256>{});
+static constexpr std::array<uint8_t, 256> kInstructionLengths =
+    MakeInstructionLengths(std::make_index_sequence<256>{});
+
 CPU::CPU() { Boot(); }
 
 CPU::~CPU() {}
@@ -35,20 +66,38 @@ int CPU::Step() {
       halted_ = false;
     }
   } else {
-    InstructionContext context;
+    uint16_t pc = registers_.ProgramCounter();
+
+    // fetch and decode the next instruction, reusing the cached decode when
+    // this address has been run before
+    DecodedInstruction decoded;
+    DecodedInstruction* instruction =
+        decodeCache_ ? decodeCache_->Find(pc) : nullptr;
+    if (instruction == nullptr) {
+      decoded = Decode(pc);
+      instruction = &decoded;
+    } else if (instruction->length == 0) {
+      *instruction = Decode(pc);
+    }
+
+    if (spdlog::should_log(spdlog::level::trace)) {
+      Trace(instruction->opcode);
+    }
 
-    // fetch next instruction
-    Fetch(context);
+    // the opcode and its operands take one m-cycle per byte
+    registers_.ProgramCounter() += instruction->length;
+    cycles_ += instruction->length;
 
-    if (context.instruction.type == InstructionType::NONE) {
-      spdlog::warn("Unknown instruction: {:02X} {}", context.instruction.opcode,
-                   context.instruction.mnemonic);
+    OpcodeHandler handler = instruction->handler;
+    if (handler == nullptr) {
+      spdlog::warn("Unknown instruction: {:02X} {}", instruction->opcode,
+                   kInstructions[instruction->opcode].mnemonic);
       return -1;
     }
 
-    Decode(context);
-
-    Execute(context);
+    // copied out first, since the handler may overwrite its own cache entry
+    operand_ = instruction->operand;
+    handler(*this);
   }
 
   if (ime_) {
@@ -64,15 +113,26 @@ int CPU::Step() {
   return 1;
 }
 
-void CPU::Fetch(InstructionContext& context) {
-  uint8_t opcode = memory_->Read(registers_.ProgramCounter());
-  context.instruction = kInstructions[opcode];
+DecodedInstruction CPU::Decode(const uint16_t addr) {
+  DecodedInstruction decoded;
+
+  decoded.opcode = memory_->Read(addr);
+  decoded.handler = kOpcodeHandlers[decoded.opcode];
+  decoded.length = kInstructionLengths[decoded.opcode];
 
+  for (int i = 1; i < decoded.length; i++) {
+    decoded.operand |= memory_->Read(addr + i) << (8 * (i - 1));
+  }
+
+  return decoded;
+}
+
+void CPU::Trace(const uint8_t opcode) {
   spdlog::trace(
       "{:08X} PC[{:04X}] {:<12} - [ {:02X} {:02X} {:02X} {:02X} ]  Flags: "
       "{}{}{}{}  A: {:02X}  BC: {:02X}{:02X}  DE: {:02X}{:02X}  HL: "
       "{:02X}{:02X}",
-      cycles_, registers_.ProgramCounter(), context.instruction.mnemonic,
+      cycles_, registers_.ProgramCounter(), kInstructions[opcode].mnemonic,
       opcode, memory_->Read(registers_.ProgramCounter() + 1),
       memory_->Read(registers_.ProgramCounter() + 2),
       memory_->Read(registers_.ProgramCounter() + 3),
@@ -81,151 +141,146 @@ void CPU::Fetch(InstructionContext& context) {
       registers_.GetCarryFlag() ? "C" : "-", registers_.af_[1],
       registers_.bc_[1], registers_.bc_[0], registers_.de_[1],
       registers_.de_[0], registers_.hl_[1], registers_.hl_[0]);
-
-  registers_.ProgramCounter()++;
-  cycles_++;
 }
 
-void CPU::Decode(InstructionContext& context) {
-  // fetch any data required
-  context.source = _readData(context.instruction.source);
-  /* context.arg2 = _readData(context.instruction.argType2); */
+//--------
+// dispatch
+template <uint8_t opcode>
+void CPU::_execute(CPU& cpu) {
+  constexpr Instruction instruction = kInstructions[opcode];
+  constexpr InstructionType type = instruction.type;
+  constexpr ArgumentType destination = instruction.destination;
+  constexpr ArgumentType source = instruction.source;
+  constexpr ConditionType condition = instruction.condition;
+
+  // fetch any data required before running the handler
+  uint16_t data = cpu._readData<source>();
+
+  if constexpr (type == InstructionType::NOP) {
+    cpu._nop();
+  } else if constexpr (type == InstructionType::JP) {
+    cpu._jp<condition>(data);
+  } else if constexpr (type == InstructionType::XOR) {
+    cpu._xor(data);
+  } else if constexpr (type == InstructionType::LD_16 ||
+                       type == InstructionType::LD ||
+                       type == InstructionType::LDH) {
+    cpu._ld<destination>(data);
+  } else if constexpr (type == InstructionType::DEC) {
+    cpu._dec<source>(data);
+  } else if constexpr (type == InstructionType::INC) {
+    cpu._inc<source>(data);
+  } else if constexpr (type == InstructionType::JR) {
+    cpu._jr<condition>(data);
+  } else if constexpr (type == InstructionType::DI) {
+    cpu._di();
+  } else if constexpr (type == InstructionType::EI) {
+    cpu._ei();
+  } else if constexpr (type == InstructionType::HALT) {
+    cpu._halt();
+  } else if constexpr (type == InstructionType::CP) {
+    cpu._cp(data);
+  } else if constexpr (type == InstructionType::RST) {
+    cpu._rst(opcode & 0x38);  // vector is encoded in bits 3-5
+  } else if constexpr (type == InstructionType::ADD) {
+    cpu._add(data);
+  } else if constexpr (type == InstructionType::ADC) {
+    cpu._adc(data);
+  } else if constexpr (type == InstructionType::POP) {
+    cpu._pop<destination>();
+  } else if constexpr (type == InstructionType::SUB) {
+    cpu._sub(data);
+  } else if constexpr (type == InstructionType::SBC) {
+    cpu._sbc(data);
+  } else if constexpr (type == InstructionType::AND) {
+    cpu._and(data);
+  } else if constexpr (type == InstructionType::OR) {
+    cpu._or(data);
+  } else if constexpr (type == InstructionType::INC16) {
+    cpu._inc16<source>(data);
+  } else if constexpr (type == InstructionType::DEC16) {
+    cpu._dec16<source>(data);
+  } else if constexpr (type == InstructionType::ADD16) {
+    cpu._add16(data);
+  } else if constexpr (type == InstructionType::PUSH) {
+    cpu._push(data);
+  } else if constexpr (type == InstructionType::RLCA) {
+    cpu._rlca();
+  } else if constexpr (type == InstructionType::RRCA) {
+    cpu._rrca();
+  } else if constexpr (type == InstructionType::RLA) {
+    cpu._rla();
+  } else if constexpr (type == InstructionType::RRA) {
+    cpu._rra();
+  } else if constexpr (type == InstructionType::DAA) {
+    cpu._daa();
+  } else if constexpr (type == InstructionType::CPL) {
+    cpu._cpl();
+  } else if constexpr (type == InstructionType::SCF) {
+    cpu._scf();
+  } else if constexpr (type == InstructionType::CCF) {
+    cpu._ccf();
+  } else if constexpr (type == InstructionType::STOP) {
+    cpu._stop();
+  } else if constexpr (type == InstructionType::RET) {
+    cpu._ret<condition>();
+  } else if constexpr (type == InstructionType::RETI) {
+    cpu._reti();
+  } else if constexpr (type == InstructionType::CALL) {
+    cpu._call<condition>(data);
+  } else if constexpr (type == InstructionType::ADD_SP_R8) {
+    cpu._addSpR8(data);
+  } else if constexpr (type == InstructionType::LD_HL_SP_R8) {
+    cpu._ldHlSpR8(data);
+  } else if constexpr (type == InstructionType::LD_SP_HL) {
+    cpu._ldSpHl(data);
+  } else if constexpr (type == InstructionType::LD_A16_SP) {
+    cpu._ldA16Sp(data);
+  } else if constexpr (type == InstructionType::PREFIX_CB) {
+    cpu._prefixCb();
+  }
 }
 
-void CPU::Execute(InstructionContext& context) {
-  switch (context.instruction.type) {
-    case InstructionType::NOP:
-      _nop(context);
-      break;
-    case InstructionType::JP:
-      _jp(context);
-      break;
-    case InstructionType::XOR:
-      _xor(context);
-      break;
-    case InstructionType::LD_16:
-      _ld16(context);
-      break;
-    case InstructionType::LD:
-      _ld(context);
-      break;
-    case InstructionType::DEC:
-      _dec(context);
-      break;
-    case InstructionType::INC:
-      _inc(context);
-      break;
-    case InstructionType::JR:
-      _jr(context);
-      break;
-    case InstructionType::DI:
-      _di(context);
-      break;
-    case InstructionType::EI:
-      _ei(context);
-      break;
-    case InstructionType::LDH:
-      _ldh(context);
-      break;
-    case InstructionType::HALT:
-      _halt(context);
-      break;
-    case InstructionType::CP:
-      _cp(context);
-      break;
-    case InstructionType::RST:
-      _rst(context);
-      break;
-    case InstructionType::ADD:
-      _add(context);
-      break;
-    case InstructionType::ADC:
-      _adc(context);
-      break;
-    case InstructionType::POP:
-      _pop(context);
-      break;
-    case InstructionType::SUB:
-      _sub(context);
-      break;
-    case InstructionType::SBC:
-      _sbc(context);
-      break;
-    case InstructionType::AND:
-      _and(context);
-      break;
-    case InstructionType::OR:
-      _or(context);
-      break;
-    case InstructionType::INC16:
-      _inc16(context);
-      break;
-    case InstructionType::DEC16:
-      _dec16(context);
-      break;
-    case InstructionType::ADD16:
-      _add16(context);
-      break;
-    case InstructionType::PUSH:
-      _push(context);
-      break;
-    case InstructionType::RLCA:
-      _rlca(context);
-      break;
-    case InstructionType::RRCA:
-      _rrca(context);
-      break;
-    case InstructionType::RLA:
-      _rla(context);
-      break;
-    case InstructionType::RRA:
-      _rra(context);
-      break;
-    case InstructionType::DAA:
-      _daa(context);
-      break;
-    case InstructionType::CPL:
-      _cpl(context);
-      break;
-    case InstructionType::SCF:
-      _scf(context);
-      break;
-    case InstructionType::CCF:
-      _ccf(context);
-      break;
-    case InstructionType::STOP:
-      _stop(context);
-      break;
-    case InstructionType::RET:
-      _ret(context);
-      break;
-    case InstructionType::RETI:
-      _reti(context);
-      break;
-    case InstructionType::CALL:
-      _call(context);
-      break;
-    case InstructionType::ADD_SP_R8:
-      _addSpR8(context);
-      break;
-    case InstructionType::LD_HL_SP_R8:
-      _ldHlSpR8(context);
-      break;
-    case InstructionType::LD_SP_HL:
-      _ldSpHl(context);
-      break;
-    case InstructionType::LD_A16_SP:
-      _ldA16Sp(context);
-      break;
-    case InstructionType::PREFIX_CB:
-      _prefixCb(context);
-      break;
-    case InstructionType::NONE:
-    default:
-      spdlog::critical("Opcode execute handler not found: {:02x} {}",
-                       context.instruction.opcode,
-                       context.instruction.mnemonic);
-      exit(-1);
+template <uint8_t cbOpcode>
+void CPU::_executeCb(CPU& cpu) {
+  // these instructions can be decoded as follows:
+  // 0bxxyyyzzz
+  // xx - operation bucket, where
+  //      00 - RLC, RRC, etc
+  //      01 - BIT
+  //      10 - RES
+  //      11 - SET
+  // yyy - select op type if xx=00 or select bit operand
+  // zzz - data source from B, C, D, E, H, L, (HL), A
+  constexpr uint8_t opBucket = (cbOpcode >> 6) & 0x03;  // top two bits
+  constexpr uint8_t opType = (cbOpcode >> 3) & 0x07;    // bits 3-5
+  constexpr uint8_t opSource = cbOpcode & 0x07;         // bits 0-2
+  constexpr ArgumentType dataSource = kArgumentTypeFromCBSource[opSource];
+
+  if constexpr (opBucket == 0b00) {
+    if constexpr (opType == 0b000) {
+      cpu._cbRlc<dataSource>();
+    } else if constexpr (opType == 0b001) {
+      cpu._cbRrc<dataSource>();
+    } else if constexpr (opType == 0b010) {
+      cpu._cbRl<dataSource>();
+    } else if constexpr (opType == 0b011) {
+      cpu._cbRr<dataSource>();
+    } else if constexpr (opType == 0b100) {
+      cpu._cbSla<dataSource>();
+    } else if constexpr (opType == 0b101) {
+      cpu._cbSra<dataSource>();
+    } else if constexpr (opType == 0b110) {
+      cpu._cbSwap<dataSource>();
+    } else {
+      cpu._cbSrl<dataSource>();
+    }
+  } else if constexpr (opBucket == 0b01) {
+    cpu._cbBit<opType, dataSource>();
+  } else if constexpr (opBucket == 0b10) {
+    cpu._cbRes<opType, dataSource>();
+  } else {
+    cpu._cbSet<opType, dataSource>();
   }
 }
 
@@ -317,276 +372,199 @@ void CPU::CallVector(uint16_t address) {
 
 //--------
 // handlers
-void CPU::_nop(InstructionContext& context) {}
+void CPU::_nop() {}
 
-void CPU::_jp(InstructionContext& context) {
-  if (_checkCondition(context.instruction.condition)) {
-    registers_.ProgramCounter() = context.source;
+template <ConditionType condition>
+void CPU::_jp(const uint16_t address) {
+  if (_checkCondition<condition>()) {
+    registers_.ProgramCounter() = address;
     cycles_++;
   }
 }
 
-void CPU::_xor(InstructionContext& context) {
-  registers_.A() ^= (context.source & 0xFF);
-
-  registers_.SetZeroFlag(registers_.A() == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(false);
-}
+void CPU::_xor(const uint8_t value) {
+  registers_.A() ^= value;
 
-void CPU::_ld16(InstructionContext& context) {
-  _writeData(context.instruction.destination, context.source);
+  registers_.SetFlags((registers_.A() == 0) << kZeroFlagBit);
 }
 
-void CPU::_ld(InstructionContext& context) {
-  _writeData(context.instruction.destination, context.source);
+template <ArgumentType destination>
+void CPU::_ld(const uint16_t value) {
+  _writeData<destination>(value);
 }
 
-void CPU::_dec(InstructionContext& context) {
-  uint8_t value = (context.source & 0xFF) - 1;
+template <ArgumentType source>
+void CPU::_dec(const uint8_t data) {
+  uint8_t value = data - 1;
 
-  _writeData(context.instruction.source, value);
+  _writeData<source>(value);
 
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(true);
-  registers_.SetHalfCarryFlag((value & 0x0F) == 0x0F);
+  registers_.DeferFlags(FlagOp::DEC, value);
 }
 
-void CPU::_inc(InstructionContext& context) {
-  uint8_t value = (context.source & 0xFF) + 1;
+template <ArgumentType source>
+void CPU::_inc(const uint8_t data) {
+  uint8_t value = data + 1;
 
-  _writeData(context.instruction.source, value);
+  _writeData<source>(value);
 
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag((value & 0x0F) == 0x00);
+  registers_.DeferFlags(FlagOp::INC, value);
 }
 
-void CPU::_jr(InstructionContext& context) {
-  if (_checkCondition(context.instruction.condition)) {
-    int8_t offset = (int8_t)(context.source & 0xFF);
+template <ConditionType condition>
+void CPU::_jr(const uint8_t data) {
+  if (_checkCondition<condition>()) {
+    int8_t offset = (int8_t)data;
 
     registers_.ProgramCounter() += offset;
     cycles_++;
   }
 }
 
-void CPU::_di(InstructionContext& context) { ime_ = false; }
+void CPU::_di() { ime_ = false; }
 
-void CPU::_ei(InstructionContext& context) { setImeNextCycle_ = true; }
-
-void CPU::_ldh(InstructionContext& context) {
-  _writeData(context.instruction.destination, context.source);
-}
+void CPU::_ei() { setImeNextCycle_ = true; }
 
-void CPU::_halt(InstructionContext& context) { halted_ = true; }
+void CPU::_halt() { halted_ = true; }
 
-void CPU::_cp(InstructionContext& context) {
-  int value = (int)registers_.A() - (int)context.source;
-
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(true);
-  registers_.SetHalfCarryFlag(
-      ((int)registers_.A() & 0x0F) - ((int)context.source & 0x0F) < 0);
-  registers_.SetCarryFlag(value < 0);
+void CPU::_cp(const uint8_t data) {
+  registers_.DeferFlags(FlagOp::SUB, registers_.A() - data, registers_.A(),
+                        data);
 }
 
-void CPU::_rst(InstructionContext& context) {
+void CPU::_rst(const uint8_t address) {
   cycles_++;  // not sure exactly where this cycle is spent
 
-  uint8_t address = 0x00;
-  switch (context.instruction.opcode) {
-    case 0xC7:
-      address = 0x00;
-      break;
-    case 0xCF:
-      address = 0x08;
-      break;
-    case 0xD7:
-      address = 0x10;
-      break;
-    case 0xDF:
-      address = 0x18;
-      break;
-    case 0xE7:
-      address = 0x20;
-      break;
-    case 0xEF:
-      address = 0x28;
-      break;
-    case 0xF7:
-      address = 0x30;
-      break;
-    case 0xFF:
-      address = 0x38;
-      break;
-  }
-
   _savePCToStack();
   registers_.ProgramCounter() = address;
 }
 
-void CPU::_add(InstructionContext& context) {
-  uint8_t value = registers_.A() + context.source;
-
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag((registers_.A() & 0xF) + (context.source & 0xF) >=
-                              0x10);
-  registers_.SetCarryFlag(((int32_t)registers_.A() & 0xFF) +
-                              ((int32_t)context.source & 0xFF) >=
-                          0x100);  // why does this have to be int?
+void CPU::_add(const uint8_t data) {
+  uint8_t value = registers_.A() + data;
 
+  registers_.DeferFlags(FlagOp::ADD, value, registers_.A(), data);
   registers_.A() = value;
 }
 
-void CPU::_adc(InstructionContext& context) {
-  uint8_t value =
-      registers_.A() + context.source + (int)registers_.GetCarryFlag();
+void CPU::_adc(const uint8_t data) {
+  // reading the carry resolves whatever set it
+  int carry = registers_.GetCarryFlag();
+  uint8_t value = registers_.A() + data + carry;
 
-  registers_.SetZeroFlag((value & 0xFF) == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag((registers_.A() & 0x0F) +
-                                  (context.source & 0x0F) +
-                                  registers_.GetCarryFlag() >
-                              0xF);
-  registers_.SetCarryFlag(
-      registers_.A() + context.source + registers_.GetCarryFlag() > 0xFF);
+  registers_.SetFlags(
+      ((value == 0) << kZeroFlagBit) |
+      (((registers_.A() & 0x0F) + (data & 0x0F) + carry > 0xF)
+       << kHalfCarryFlagBit) |
+      ((registers_.A() + data + carry > 0xFF) << kCarryFlagBit));
 
   registers_.A() = value;
 }
 
-void CPU::_pop(InstructionContext& context) {
-  uint16_t data =
-      _stackPopWord();  // consider doing this in the data fetch stage
-  _writeData(context.instruction.destination, data);
+template <ArgumentType destination>
+void CPU::_pop() {
+  uint16_t data = _stackPopWord();
+  _writeData<destination>(data);
 }
 
-void CPU::_sub(InstructionContext& context) {
-  uint8_t value = registers_.A() - context.source;
-
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(true);
-  registers_.SetHalfCarryFlag(
-      ((int16_t)registers_.A() & 0x0F) - ((int16_t)context.source & 0x0F) < 0);
-  registers_.SetCarryFlag(
-      ((int16_t)registers_.A()) - ((int16_t)context.source) < 0);
+void CPU::_sub(const uint8_t data) {
+  uint8_t value = registers_.A() - data;
 
+  registers_.DeferFlags(FlagOp::SUB, value, registers_.A(), data);
   registers_.A() = value;
 }
 
-void CPU::_sbc(InstructionContext& context) {
+void CPU::_sbc(const uint8_t data) {
   // TODO double check this implementation
-  uint8_t value =
-      registers_.A() - context.source - (int)registers_.GetCarryFlag();
+  int carry = registers_.GetCarryFlag();
+  uint8_t value = registers_.A() - data - carry;
 
-  registers_.SetZeroFlag(value == 0);
-  registers_.SetSubFlag(true);
-  registers_.SetHalfCarryFlag(((int16_t)registers_.A() & 0x0F) -
-                                  ((int16_t)context.source & 0x0F) -
-                                  (int)registers_.GetCarryFlag() <
-                              0);
-  registers_.SetCarryFlag(((int16_t)registers_.A()) -
-                              ((int16_t)context.source) -
-                              (int)registers_.GetCarryFlag() <
-                          0);
+  registers_.SetFlags(
+      ((value == 0) << kZeroFlagBit) | (0x1 << kAddSubFlagBit) |
+      ((((int16_t)registers_.A() & 0x0F) - ((int16_t)data & 0x0F) - carry < 0)
+       << kHalfCarryFlagBit) |
+      ((((int16_t)registers_.A()) - ((int16_t)data) - carry < 0)
+       << kCarryFlagBit));
 
   registers_.A() = value;
 }
 
-void CPU::_and(InstructionContext& context) {
-  registers_.A() &= context.source & 0xFF;
+void CPU::_and(const uint8_t data) {
+  registers_.A() &= data;
 
-  registers_.SetZeroFlag(registers_.A() == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(true);
-  registers_.SetCarryFlag(false);
+  registers_.SetFlags(((registers_.A() == 0) << kZeroFlagBit) |
+                      (0x1 << kHalfCarryFlagBit));
 }
 
-void CPU::_or(InstructionContext& context) {
-  registers_.A() |= context.source & 0xFF;
+void CPU::_or(const uint8_t data) {
+  registers_.A() |= data;
 
-  registers_.SetZeroFlag(registers_.A() == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(false);
+  registers_.SetFlags((registers_.A() == 0) << kZeroFlagBit);
 }
 
-void CPU::_inc16(InstructionContext& context) {
-  uint16_t value = context.source + 1;
+template <ArgumentType source>
+void CPU::_inc16(const uint16_t data) {
+  uint16_t value = data + 1;
 
   cycles_++;
-  _writeData(context.instruction.source, value);
+  _writeData<source>(value);
 }
 
-void CPU::_dec16(InstructionContext& context) {
-  uint16_t value = context.source - 1;
+template <ArgumentType source>
+void CPU::_dec16(const uint16_t data) {
+  uint16_t value = data - 1;
 
   cycles_++;
-  _writeData(context.instruction.source, value);
+  _writeData<source>(value);
 }
 
-void CPU::_add16(InstructionContext& context) {
-  uint16_t value = registers_.HL() + context.source;
+void CPU::_add16(const uint16_t data) {
+  uint16_t value = registers_.HL() + data;
 
   registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(
-      (registers_.HL() & 0xFFF) + (context.source & 0xFFF) >= 0x1000);
-  registers_.SetCarryFlag(
-      ((uint32_t)registers_.HL()) + ((uint32_t)context.source) >= 0x10000);
+  registers_.SetHalfCarryFlag((registers_.HL() & 0xFFF) + (data & 0xFFF) >=
+                              0x1000);
+  registers_.SetCarryFlag(((uint32_t)registers_.HL()) + ((uint32_t)data) >=
+                          0x10000);
 
   cycles_++;
   registers_.HL() = value;
 }
 
-void CPU::_push(InstructionContext& context) {
-  _stackPushWord(context.source);
+void CPU::_push(const uint16_t data) {
+  _stackPushWord(data);
   cycles_++;
 }
 
-void CPU::_rlca(InstructionContext& context) {
+void CPU::_rlca() {
   bool carry = (registers_.A() >> 7) & 0x01;  // check if leftmost bit is set
 
   registers_.A() = (registers_.A() << 1) | ((uint8_t)carry);
-  registers_.SetZeroFlag(false);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  registers_.SetFlags(carry << kCarryFlagBit);
 }
 
-void CPU::_rrca(InstructionContext& context) {
+void CPU::_rrca() {
   bool carry = registers_.A() & 0x01;  // check if rightmost bit is set
 
   registers_.A() = (registers_.A() >> 1) | ((uint8_t)carry << 7);
-  registers_.SetZeroFlag(false);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  registers_.SetFlags(carry << kCarryFlagBit);
 }
 
-void CPU::_rla(InstructionContext& context) {
+void CPU::_rla() {
   bool carry = (registers_.A() >> 7) & 0x01;  // check if leftmost bit is set
 
   registers_.A() = (registers_.A() << 1) | ((uint8_t)registers_.GetCarryFlag());
-  registers_.SetZeroFlag(false);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  registers_.SetFlags(carry << kCarryFlagBit);
 }
 
-void CPU::_rra(InstructionContext& context) {
+void CPU::_rra() {
   bool carry = registers_.A() & 0x01;
 
   registers_.A() =
       (registers_.A() >> 1) | ((uint8_t)registers_.GetCarryFlag() << 7);
-  registers_.SetZeroFlag(false);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  registers_.SetFlags(carry << kCarryFlagBit);
 }
 
-void CPU::_daa(InstructionContext& context) {
+void CPU::_daa() {
   bool carryFlag = false;
   uint8_t value = 0;
 
@@ -608,36 +586,37 @@ void CPU::_daa(InstructionContext& context) {
   registers_.SetCarryFlag(carryFlag);
 }
 
-void CPU::_cpl(InstructionContext& context) {
+void CPU::_cpl() {
   registers_.A() = ~registers_.A();
   registers_.SetSubFlag(true);
   registers_.SetHalfCarryFlag(true);
 }
 
-void CPU::_scf(InstructionContext& context) {
+void CPU::_scf() {
   registers_.SetSubFlag(false);
   registers_.SetHalfCarryFlag(false);
   registers_.SetCarryFlag(true);
 }
 
-void CPU::_ccf(InstructionContext& context) {
+void CPU::_ccf() {
   registers_.SetSubFlag(false);
   registers_.SetHalfCarryFlag(false);
   registers_.SetCarryFlag(registers_.GetCarryFlag() ^ 0x1);
 }
 
-void CPU::_stop(InstructionContext& context) {
+void CPU::_stop() {
   spdlog::info("Received STOP");
   exit(0);  // TODO exit more gracefully
 }
 
-void CPU::_ret(InstructionContext& context) {
+template <ConditionType condition>
+void CPU::_ret() {
   // branching adds an extra cycle
-  if (context.instruction.condition != ConditionType::NONE) {
+  if constexpr (condition != ConditionType::NONE) {
     cycles_++;
   }
 
-  if (_checkCondition(context.instruction.condition)) {
+  if (_checkCondition<condition>()) {
     uint16_t returnAddr = _stackPopWord();
 
     registers_.ProgramCounter() = returnAddr;
@@ -645,302 +624,203 @@ void CPU::_ret(InstructionContext& context) {
   }
 }
 
-void CPU::_reti(InstructionContext& context) {
+void CPU::_reti() {
   // returning from interrupt, so re-enable ime
   ime_ = true;
-  _ret(context);
+  _ret<ConditionType::NONE>();
 }
 
-void CPU::_call(InstructionContext& context) {
-  if (_checkCondition(context.instruction.condition)) {
+template <ConditionType condition>
+void CPU::_call(const uint16_t address) {
+  if (_checkCondition<condition>()) {
     _savePCToStack();
 
-    registers_.ProgramCounter() = context.source;
+    registers_.ProgramCounter() = address;
     cycles_++;
   }
 }
 
-void CPU::_addSpR8(InstructionContext& context) {
-  uint16_t value = registers_.StackPointer() + (int8_t)context.source;
+void CPU::_addSpR8(const uint8_t data) {
+  uint16_t value = registers_.StackPointer() + (int8_t)data;
 
   registers_.SetZeroFlag(false);
   registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(
-      (registers_.StackPointer() & 0xF) + (context.source & 0xF) >= 0x10);
+  registers_.SetHalfCarryFlag((registers_.StackPointer() & 0xF) + (data & 0xF) >=
+                              0x10);
   registers_.SetCarryFlag(((int32_t)registers_.StackPointer() & 0xFF) +
-                              ((int32_t)context.source & 0xFF) >=
+                              ((int32_t)data & 0xFF) >=
                           0x100);
 
   registers_.StackPointer() = value;
 }
 
-void CPU::_ldHlSpR8(InstructionContext& context) {
-  uint16_t value = registers_.StackPointer() + (int8_t)context.source;
+void CPU::_ldHlSpR8(const uint8_t data) {
+  uint16_t value = registers_.StackPointer() + (int8_t)data;
 
   registers_.SetZeroFlag(false);
   registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(
-      (registers_.StackPointer() & 0xF) + (context.source & 0xF) >= 0x10);
-  registers_.SetCarryFlag(
-      (registers_.StackPointer() & 0xFF) + (context.source & 0xFF) >= 0x100);
+  registers_.SetHalfCarryFlag((registers_.StackPointer() & 0xF) + (data & 0xF) >=
+                              0x10);
+  registers_.SetCarryFlag((registers_.StackPointer() & 0xFF) + (data & 0xFF) >=
+                          0x100);
 
   registers_.HL() = value;
   cycles_++;
 }
 
-void CPU::_ldSpHl(InstructionContext& context) {
-  registers_.StackPointer() = context.source;
+void CPU::_ldSpHl(const uint16_t data) {
+  registers_.StackPointer() = data;
   cycles_++;
 }
 
-void CPU::_ldA16Sp(InstructionContext& context) {
+void CPU::_ldA16Sp(const uint16_t data) {
   uint16_t address = _readImm16();
 
-  _writeMem(address, context.source & 0x00FF);             // lower byte
-  _writeMem(address + 1, (context.source >> 8) & 0x00FF);  // upper byte
+  _writeMem(address, data & 0x00FF);             // lower byte
+  _writeMem(address + 1, (data >> 8) & 0x00FF);  // upper byte
 }
 
-void CPU::_prefixCb(InstructionContext& context) {
-  // these instructions can be decoded as follows:
-  // 0bxxyyyzzz
-  // xx - operation bucket, where
-  //      00 - RLC, RRC, etc
-  //      01 - BIT
-  //      10 - RES
-  //      11 - SET
-  // yyy - select op type if xx=00 or select bit operand
-  // zzz - data source from B, C, D, E, H, L, (HL), A
+void CPU::_prefixCb() {
   uint8_t cbOpcode = _readImm8();
 
-  uint8_t opBucket = (cbOpcode >> 6) & 0x03;  // top two bits
-  uint8_t opType = (cbOpcode >> 3) & 0x07;    // bits 3-5
-  uint8_t opSource = cbOpcode & 0x07;         // bits 0-2
-  ArgumentType dataSource = kArgumentTypeFromCBSource[opSource];
-
-  switch (opBucket) {
-    case 0b00:
-      switch (opType) {
-        case 0b000:
-          _cbRlc(dataSource);
-          break;
-        case 0b001:
-          _cbRrc(dataSource);
-          break;
-        case 0b010:
-          _cbRl(dataSource);
-          break;
-        case 0b011:
-          _cbRr(dataSource);
-          break;
-        case 0b100:
-          _cbSla(dataSource);
-          break;
-        case 0b101:
-          _cbSra(dataSource);
-          break;
-        case 0b110:
-          _cbSwap(dataSource);
-          break;
-        case 0b111:
-          _cbSrl(dataSource);
-          break;
-      }
-      break;
-    case 0b01:
-      _cbBit(opType, dataSource);
-      break;
-    case 0b10:
-      _cbRes(opType, dataSource);
-      break;
-    case 0b11:
-      _cbSet(opType, dataSource);
-      break;
-  }
+  kCbOpcodeHandlers[cbOpcode](*this);
 }
 
 //--------
 // helpers
-uint16_t CPU::_readData(ArgumentType argumentType) {
-  uint16_t data;
-
-  switch (argumentType) {
-    case ArgumentType::IMM_16:
-      data = _readImm16();
-      break;
-    case ArgumentType::B:
-      data = registers_.B();
-      break;
-    case ArgumentType::C:
-      data = registers_.C();
-      break;
-    case ArgumentType::D:
-      data = registers_.D();
-      break;
-    case ArgumentType::E:
-      data = registers_.E();
-      break;
-    case ArgumentType::H:
-      data = registers_.H();
-      break;
-    case ArgumentType::L:
-      data = registers_.L();
-      break;
-    case ArgumentType::MEM_AT_HL:
-      data = _readMem(registers_.HL());
-      break;
-    case ArgumentType::A:
-      data = registers_.A();
-      break;
-    case ArgumentType::BC:
-      data = registers_.BC();
-      break;
-    case ArgumentType::DE:
-      data = registers_.DE();
-      break;
-    case ArgumentType::HL:
-      data = registers_.HL();
-      break;
-    case ArgumentType::SP:
-      data = registers_.StackPointer();
-      break;
-    case ArgumentType::IMM_8:
-      data = _readImm8();
-      break;
-    case ArgumentType::MEM_AT_BC:
-      data = _readMem(registers_.BC());
-      break;
-    case ArgumentType::MEM_AT_DE:
-      data = _readMem(registers_.DE());
-      break;
-    case ArgumentType::MEM_AT_HLI:
-      data = _readMem(registers_.HL()++);
-      break;
-    case ArgumentType::MEM_AT_HLD:
-      data = _readMem(registers_.HL()--);
-      break;
-    case ArgumentType::MEM_AT_A8:
-      data = _readMem(0xFF00 | _readImm8());
-      break;
-    case ArgumentType::MEM_AT_C:
-      data = _readMem(0xFF00 | registers_.C());
-      break;
-    case ArgumentType::MEM_AT_A16:
-      data = _readMem(_readImm16());
-      break;
-    case ArgumentType::AF:
-      data = registers_.AF();
-      break;
-    case ArgumentType::NONE:
-      break;
-    default:
-      spdlog::warn("Unknown _readData ArgumentType");
+template <ArgumentType argumentType>
+uint16_t CPU::_readData() {
+  if constexpr (argumentType == ArgumentType::IMM_16) {
+    return _readImm16();
+  } else if constexpr (argumentType == ArgumentType::B) {
+    return registers_.B();
+  } else if constexpr (argumentType == ArgumentType::C) {
+    return registers_.C();
+  } else if constexpr (argumentType == ArgumentType::D) {
+    return registers_.D();
+  } else if constexpr (argumentType == ArgumentType::E) {
+    return registers_.E();
+  } else if constexpr (argumentType == ArgumentType::H) {
+    return registers_.H();
+  } else if constexpr (argumentType == ArgumentType::L) {
+    return registers_.L();
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HL) {
+    return _readMem(registers_.HL());
+  } else if constexpr (argumentType == ArgumentType::A) {
+    return registers_.A();
+  } else if constexpr (argumentType == ArgumentType::BC) {
+    return registers_.BC();
+  } else if constexpr (argumentType == ArgumentType::DE) {
+    return registers_.DE();
+  } else if constexpr (argumentType == ArgumentType::HL) {
+    return registers_.HL();
+  } else if constexpr (argumentType == ArgumentType::SP) {
+    return registers_.StackPointer();
+  } else if constexpr (argumentType == ArgumentType::IMM_8) {
+    return _readImm8();
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_BC) {
+    return _readMem(registers_.BC());
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_DE) {
+    return _readMem(registers_.DE());
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HLI) {
+    return _readMem(registers_.HL()++);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HLD) {
+    return _readMem(registers_.HL()--);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_A8) {
+    return _readMem(0xFF00 | _readImm8());
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_C) {
+    return _readMem(0xFF00 | registers_.C());
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_A16) {
+    return _readMem(_readImm16());
+  } else if constexpr (argumentType == ArgumentType::AF) {
+    return registers_.AF();
+  } else {
+    return 0;  // ArgumentType::NONE
   }
-
-  return data;
 }
 
+// immediates are fetched and counted along with the opcode, so these just
+// consume the decoded operand bytes
 uint16_t CPU::_readImm16() {
-  uint8_t low = _readMem(registers_.ProgramCounter()++);
-  uint8_t high = _readMem(registers_.ProgramCounter()++);
+  uint8_t low = _readImm8();
+  uint8_t high = _readImm8();
 
   return (high << 8) | low;
 }
 
-uint8_t CPU::_readImm8() { return _readMem(registers_.ProgramCounter()++); }
+uint8_t CPU::_readImm8() {
+  uint8_t data = operand_ & 0xFF;
+  operand_ >>= 8;
+
+  return data;
+}
 
 uint8_t CPU::_readMem(uint16_t addr) {
   cycles_++;
   return memory_->Read(addr);
 }
 
-bool CPU::_checkCondition(ConditionType conditionType) {
-  switch (conditionType) {
-    case ConditionType::NZ:
-      return !registers_.GetZeroFlag();
-    case ConditionType::Z:
-      return registers_.GetZeroFlag();
-    case ConditionType::NC:
-      return !registers_.GetCarryFlag();
-    case ConditionType::C:
-      return registers_.GetCarryFlag();
-    case ConditionType::NONE:
-    default:
-      return true;
+template <ConditionType conditionType>
+bool CPU::_checkCondition() {
+  if constexpr (conditionType == ConditionType::NZ) {
+    return !registers_.GetZeroFlag();
+  } else if constexpr (conditionType == ConditionType::Z) {
+    return registers_.GetZeroFlag();
+  } else if constexpr (conditionType == ConditionType::NC) {
+    return !registers_.GetCarryFlag();
+  } else if constexpr (conditionType == ConditionType::C) {
+    return registers_.GetCarryFlag();
+  } else {
+    return true;  // ConditionType::NONE
   }
 }
 
-void CPU::_writeData(ArgumentType argumentType, uint16_t data) {
-  switch (argumentType) {
-    /* case ArgumentType::IMM_16: */
-    /*     spdlog::warn("Invalid _writeData argument type"); */
-    /*     break; */
-    case ArgumentType::B:
-      registers_.B() = data & 0x00FF;
-      break;
-    case ArgumentType::C:
-      registers_.C() = data & 0x00FF;
-      break;
-    case ArgumentType::D:
-      registers_.D() = data & 0x00FF;
-      break;
-    case ArgumentType::E:
-      registers_.E() = data & 0x00FF;
-      break;
-    case ArgumentType::H:
-      registers_.H() = data & 0x00FF;
-      break;
-    case ArgumentType::L:
-      registers_.L() = data & 0x00FF;
-      break;
-    case ArgumentType::MEM_AT_HL:
-      _writeMem(registers_.HL(), data & 0x00FF);
-      break;
-    case ArgumentType::A:
-      registers_.A() = data & 0x00FF;
-      break;
-    case ArgumentType::BC:
-      registers_.BC() = data;
-      break;
-    case ArgumentType::DE:
-      registers_.DE() = data;
-      break;
-    case ArgumentType::HL:
-      registers_.HL() = data;
-      break;
-    case ArgumentType::SP:
-      registers_.StackPointer() = data;
-      break;
-    /* case ArgumentType::IMM_8: */
-    /*     spdlog::warn("Invalid _writeData argument type"); */
-    /*     break; */
-    case ArgumentType::MEM_AT_BC:
-      _writeMem(registers_.BC(), data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_DE:
-      _writeMem(registers_.DE(), data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_HLI:
-      _writeMem(registers_.HL()++, data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_HLD:
-      _writeMem(registers_.HL()--, data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_A8:
-      _writeMem((0xFF00 | _readImm8()), data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_C:
-      _writeMem((0xFF00 | registers_.C()), data & 0x00FF);
-      break;
-    case ArgumentType::MEM_AT_A16:
-      _writeMem(_readImm16(), data & 0x00FF);
-      break;
-    case ArgumentType::AF:
-      registers_.AF() = data & 0xFFF0;  // skip last nibble when writing to AF
-      break;
-    case ArgumentType::NONE:
-      break;
-    default:
-      spdlog::warn("Unknown ArgumentType for _writeData");
+template <ArgumentType argumentType>
+void CPU::_writeData(uint16_t data) {
+  if constexpr (argumentType == ArgumentType::B) {
+    registers_.B() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::C) {
+    registers_.C() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::D) {
+    registers_.D() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::E) {
+    registers_.E() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::H) {
+    registers_.H() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::L) {
+    registers_.L() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HL) {
+    _writeMem(registers_.HL(), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::A) {
+    registers_.A() = data & 0x00FF;
+  } else if constexpr (argumentType == ArgumentType::BC) {
+    registers_.BC() = data;
+  } else if constexpr (argumentType == ArgumentType::DE) {
+    registers_.DE() = data;
+  } else if constexpr (argumentType == ArgumentType::HL) {
+    registers_.HL() = data;
+  } else if constexpr (argumentType == ArgumentType::SP) {
+    registers_.StackPointer() = data;
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_BC) {
+    _writeMem(registers_.BC(), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_DE) {
+    _writeMem(registers_.DE(), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HLI) {
+    _writeMem(registers_.HL()++, data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_HLD) {
+    _writeMem(registers_.HL()--, data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_A8) {
+    _writeMem((0xFF00 | _readImm8()), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_C) {
+    _writeMem((0xFF00 | registers_.C()), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::MEM_AT_A16) {
+    _writeMem(_readImm16(), data & 0x00FF);
+  } else if constexpr (argumentType == ArgumentType::AF) {
+    registers_.AF() = data & 0xFFF0;  // skip last nibble when writing to AF
+  } else {
+    // immediates are never written to
+    static_assert(argumentType == ArgumentType::NONE,
+                  "Invalid _writeData argument type");
   }
 }
 
@@ -974,119 +854,149 @@ uint16_t CPU::_stackPopWord() {
 
 void CPU::_savePCToStack() { _stackPushWord(registers_.ProgramCounter()); }
 
-void CPU::_cbRlc(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbRlc() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & (0x01 << 7);
   uint8_t rotated = (value << 1) | ((uint8_t)carry);
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbRrc(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbRrc() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & 0x01;
   uint8_t rotated = (value >> 1) | (((uint8_t)carry) << 7);
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbRl(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbRl() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & (0x01 << 7);
   uint8_t rotated = (value << 1) | ((uint8_t)registers_.GetCarryFlag());
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbRr(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbRr() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & 0x01;
   uint8_t rotated = ((uint8_t)registers_.GetCarryFlag() << 7) | (value >> 1);
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbSla(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbSla() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & (0x01 << 7);
   uint8_t rotated = value << 1;
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbSra(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbSra() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & 0x01;
   uint8_t rotated = (int8_t)value >> 1;
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbSwap(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbSwap() {
+  uint8_t value = _readData<dataSource>();
   uint8_t swapped = ((value & 0x0F) << 4) | ((value & 0xF0) >> 4);
 
-  _writeData(dataSource, swapped);
-  registers_.SetZeroFlag(swapped == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(false);
+  _writeData<dataSource>(swapped);
+  registers_.SetFlags((swapped == 0) << kZeroFlagBit);
 }
 
-void CPU::_cbSrl(ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <ArgumentType dataSource>
+void CPU::_cbSrl() {
+  uint8_t value = _readData<dataSource>();
   bool carry = value & 0x01;
   uint8_t rotated = value >> 1;
 
-  _writeData(dataSource, rotated);
-  registers_.SetZeroFlag(rotated == 0);
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(false);
-  registers_.SetCarryFlag(carry);
+  _writeData<dataSource>(rotated);
+  registers_.SetFlags(((rotated == 0) << kZeroFlagBit) |
+                      (carry << kCarryFlagBit));
 }
 
-void CPU::_cbBit(uint8_t bit, ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <uint8_t bit, ArgumentType dataSource>
+void CPU::_cbBit() {
+  uint8_t value = _readData<dataSource>();
 
-  registers_.SetZeroFlag(!(value & (0x01 << bit)));
-  registers_.SetSubFlag(false);
-  registers_.SetHalfCarryFlag(true);
+  registers_.DeferFlags(FlagOp::BIT, value & (0x01 << bit));
 }
 
-void CPU::_cbRes(uint8_t bit, ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <uint8_t bit, ArgumentType dataSource>
+void CPU::_cbRes() {
+  uint8_t value = _readData<dataSource>();
   value &= ~(0x01 << bit);
 
-  _writeData(dataSource, value);
+  _writeData<dataSource>(value);
 }
 
-void CPU::_cbSet(uint8_t bit, ArgumentType dataSource) {
-  uint8_t value = _readData(dataSource);
+template <uint8_t bit, ArgumentType dataSource>
+void CPU::_cbSet() {
+  uint8_t value = _readData<dataSource>();
   value |= 0x01 << bit;
 
-  _writeData(dataSource, value);
+  _writeData<dataSource>(value);
+}
+
+void CPU::SaveState(StateWriter& state) {
+  registers_.ResolveFlags();
+
+  state.BeginSection(StateSection::CPU);
+  state.Write(registers_.af_);
+  state.Write(registers_.bc_);
+  state.Write(registers_.de_);
+  state.Write(registers_.hl_);
+  state.Write(registers_.sp_);
+  state.Write(registers_.pc_);
+  state.Write(cycles_);
+  state.Write(operand_);
+  state.Write(ime_);
+  state.Write(setImeNextCycle_);
+  state.Write(halted_);
+  state.Write(ie_);
+  state.Write(if_);
+  state.EndSection();
+}
+
+void CPU::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::CPU);
+  state.Read(registers_.af_);
+  registers_.flagOp_ = FlagOp::NONE;
+  state.Read(registers_.bc_);
+  state.Read(registers_.de_);
+  state.Read(registers_.hl_);
+  state.Read(registers_.sp_);
+  state.Read(registers_.pc_);
+  state.Read(cycles_);
+  state.Read(operand_);
+  state.Read(ime_);
+  state.Read(setImeNextCycle_);
+  state.Read(halted_);
+  state.Read(ie_);
+  state.Read(if_);
 }
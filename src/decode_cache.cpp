@@ -0,0 +1,73 @@
+#include "decode_cache.h"
+
+#include "address_bus.h"
+
+// instructions are at most 3 bytes, so anything starting in the last 2 bytes
+// of a region could read operands from somewhere else and is never cached
+const uint16_t kDecodeCacheMaxOperandBytes = 2;
+
+DecodeCache::DecodeCache() {}
+
+DecodeCache::~DecodeCache() {}
+
+DecodedInstruction* DecodeCache::Find(const uint16_t addr) {
+  if (addr <= kRomBankEnd) {
+    uint16_t offset = addr & (kDecodeCacheBankSize - 1);
+    if (offset >= kDecodeCacheBankSize - kDecodeCacheMaxOperandBytes) {
+      return nullptr;
+    }
+
+    if (addr < kDecodeCacheBankSize) {
+      return &(*GetRomBank(0))[offset];
+    }
+
+    // the bus selects the cartridge's bank, this is its value after reset
+    if (switchableBank_ == nullptr) {
+      SelectRomBank(1);
+    }
+
+    return &(*switchableBank_)[offset];
+  }
+
+  if (addr >= kWramStart &&
+      addr <= kWramEnd - kDecodeCacheMaxOperandBytes) {
+    return &wram_[addr - kWramStart];
+  }
+
+  if (addr >= kHramStart &&
+      addr <= kHramEnd - kDecodeCacheMaxOperandBytes) {
+    return &hram_[addr - kHramStart];
+  }
+
+  return nullptr;
+}
+
+void DecodeCache::Invalidate(const uint16_t addr) {
+  // the written byte may be the opcode or either operand of an instruction
+  for (uint16_t i = 0; i <= kDecodeCacheMaxOperandBytes; i++) {
+    uint16_t start = addr - i;
+
+    if (start >= kWramStart && start <= kWramEnd) {
+      wram_[start - kWramStart].length = 0;
+    } else if (start >= kHramStart && start <= kHramEnd) {
+      hram_[start - kHramStart].length = 0;
+    }
+  }
+}
+
+void DecodeCache::SelectRomBank(const uint16_t bank) {
+  switchableBank_ = GetRomBank(bank);
+}
+
+DecodedBank* DecodeCache::GetRomBank(const uint16_t bank) {
+  if (bank >= romBanks_.size()) {
+    romBanks_.resize(bank + 1);
+  }
+
+  // banks are only allocated once code has been run from them
+  if (romBanks_[bank] == nullptr) {
+    romBanks_[bank] = std::make_unique<DecodedBank>();
+  }
+
+  return romBanks_[bank].get();
+}
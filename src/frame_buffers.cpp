@@ -0,0 +1,36 @@
+#include "frame_buffers.h"
+
+const uint8_t kFrameBufferIndex = 0x03;
+const uint8_t kFrameBufferUnseen = 0x04;
+
+FrameBuffers::FrameBuffers(const size_t size) {
+  for (auto& buffer : buffers_) {
+    buffer.resize(size);
+  }
+}
+
+FrameBuffers::~FrameBuffers() {}
+
+uint32_t* FrameBuffers::Back() { return buffers_[back_].data(); }
+
+// hands the back buffer over as the newest frame and takes whichever one
+// the presenter isn't holding to draw the next frame into
+void FrameBuffers::Publish() {
+  sequences_[back_] = ++published_;
+  back_ = middle_.exchange(back_ | kFrameBufferUnseen,
+                           std::memory_order_acq_rel) &
+          kFrameBufferIndex;
+}
+
+// Takes the newest frame if there is one and returns the sequence number of
+// the front buffer, so presenters can skip work when it hasn't changed.
+uint64_t FrameBuffers::Acquire() {
+  if (middle_.load(std::memory_order_relaxed) & kFrameBufferUnseen) {
+    front_ = middle_.exchange(front_, std::memory_order_acq_rel) &
+             kFrameBufferIndex;
+  }
+
+  return sequences_[front_];
+}
+
+const uint32_t* FrameBuffers::Front() { return buffers_[front_].data(); }
@@ -0,0 +1,95 @@
+#include "frame_pacer.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+static int64_t NowNs() {
+#if defined(__linux__)
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return int64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+static void SleepUntil(const int64_t deadline) {
+#if defined(__linux__)
+  timespec until;
+  until.tv_sec = deadline / 1000000000;
+  until.tv_nsec = deadline % 1000000000;
+  // restarts after signals, since the deadline is absolute
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr) ==
+         EINTR) {
+  }
+#else
+  std::this_thread::sleep_until(std::chrono::steady_clock::time_point(
+      std::chrono::nanoseconds(deadline)));
+#endif
+}
+
+FramePacer::FramePacer(const double rate) {
+  SetRate(rate);
+  Reset();
+}
+
+FramePacer::~FramePacer() {}
+
+// e.g. the display's refresh rate, so each frame lines up with one refresh
+// instead of slipping one every few seconds
+void FramePacer::SetRate(const double rate) { periodNs_ = 1e9 / rate; }
+
+void FramePacer::Reset() {
+  lastFrame_ = NowNs();
+  deadline_ = lastFrame_ + periodNs_;
+}
+
+void FramePacer::Wait() {
+  int64_t now = NowNs();
+
+  if (now - deadline_ > periodNs_) {
+    stats_.late++;
+    deadline_ = now;
+  } else {
+    if (deadline_ - now > kFramePacerSpinNs) {
+      SleepUntil(deadline_ - kFramePacerSpinNs);
+    }
+    while ((now = NowNs()) < deadline_) {
+    }
+  }
+
+  double frameMs = (now - lastFrame_) / 1e6;
+  lastFrame_ = now;
+  deadline_ += periodNs_;
+
+  stats_.frames++;
+  double delta = frameMs - stats_.meanMs;
+  stats_.meanMs += delta / stats_.frames;
+  m2_ += delta * (frameMs - stats_.meanMs);
+  if (stats_.frames == 1 || frameMs < stats_.minMs) {
+    stats_.minMs = frameMs;
+  }
+  if (frameMs > stats_.maxMs) {
+    stats_.maxMs = frameMs;
+  }
+}
+
+// returns the stats since the last call and starts collecting new ones
+FramePacerStats FramePacer::TakeStats() {
+  FramePacerStats stats = stats_;
+  if (stats.frames > 1) {
+    stats.jitterMs = std::sqrt(m2_ / (stats.frames - 1));
+  }
+
+  stats_ = FramePacerStats();
+  m2_ = 0;
+  return stats;
+}
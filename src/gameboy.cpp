@@ -0,0 +1,272 @@
+#include "gameboy.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "cart/constants.h"
+#include "cart/mbc1.h"
+#include "cart/mbc3.h"
+#include "cart/util.h"
+#include "spdlog/spdlog.h"
+
+System::System() : timer_(scheduler_) {}
+
+System::~System() {}
+
+// the bus is the one component the GameBoy owns, since it knows the mapper
+void System::Connect(Cart& cart, AddressBus& addressBus) {
+  addressBus_ = &addressBus;
+  cpu_.memory_ = addressBus_;
+  cpu_.decodeCache_ = &decodeCache_;
+  addressBus_->decodeCache_ = &decodeCache_;
+  addressBus_->io_ = &io_;
+  addressBus_->ppu_ = &ppu_;
+  io_.timer_ = &timer_;
+  io_.cpu_ = &cpu_;
+  io_.ppu_ = &ppu_;
+  timer_.cpu_ = &cpu_;
+  ppu_.memory_ = addressBus_;
+  ppu_.cpu_ = &cpu_;
+  ppu_.scheduler_ = &scheduler_;
+  ppu_.catchUp_ = true;
+  scheduler_.handlers_[(int)EventType::PPU_MODE] = &ppu_;
+  scheduler_.handlers_[(int)EventType::DMA] = &ppu_;
+  scheduler_.handlers_[(int)EventType::TIMER_OVERFLOW] = &timer_;
+
+  addressBus_->MapMemory();
+  decodeCache_.SelectRomBank(cart.RomBank());
+  ppu_.ScheduleEvents();
+  timer_.ScheduleEvents();
+}
+
+// Runs the next frame without drawing it, then the given number of frames
+// past it with the same input, drawing only the last, and rolls back to the
+// end of the first. The screen buffer isn't part of the state, so it keeps
+// the frame from the future and the game's own input lag is hidden.
+// FRAME_END handlers are called once, for the frame that was kept.
+bool System::RunAhead(const uint32_t frames) {
+  if (frames == 0) {
+    return RunFrame();
+  }
+
+  auto& frameEnd = scheduler_.handlers_[(int)EventType::FRAME_END];
+  EventHandler* handler = frameEnd;
+  frameEnd = nullptr;
+  bool skipRender = ppu_.skipRender_;
+
+  ppu_.skipRender_ = true;
+  bool ok = RunFrame();
+  SaveState(runAheadState_);
+
+  for (uint32_t i = 0; ok && i < frames; i++) {
+    ppu_.skipRender_ = skipRender || i + 1 < frames;
+    ok = RunFrame();
+  }
+
+  LoadState(runAheadState_);
+  ppu_.skipRender_ = skipRender;
+  frameEnd = handler;
+
+  // the kept frame's event may still be pending in the restored state
+  scheduler_.Cancel(EventType::FRAME_END);
+  if (handler != nullptr) {
+    handler->HandleEvent(EventType::FRAME_END);
+  }
+
+  return ok;
+}
+
+// Catch-up is on by default. Without it the ppu runs in lockstep with an
+// event at every mode change, which is slower but simpler to follow.
+void System::SetPPUCatchUp(const bool catchUp) {
+  ppu_.catchUp_ = catchUp;
+  ppu_.Sync();  // reschedules for the new mode
+}
+
+// Snapshots the whole machine into state, reusing its memory so repeated
+// saves don't allocate.
+void System::SaveState(std::vector<uint8_t>& state) {
+  StateWriter writer(state);
+  Cart& cart = GetCart();
+
+  writer.BeginSection(StateSection::SYSTEM);
+  writer.Write(cart.cartType_);
+  writer.Write(cart.globalChecksum_);
+  writer.EndSection();
+
+  cpu_.SaveState(writer);
+  timer_.SaveState(writer);
+  io_.SaveState(writer);
+  ppu_.SaveState(writer);
+  addressBus_->SaveState(writer);
+  scheduler_.SaveState(writer);
+  cart.SaveState(writer);
+}
+
+// States from another version or cartridge are rejected before anything is
+// changed. A truncated one may be partially loaded and still return false.
+bool System::LoadState(const std::vector<uint8_t>& state) {
+  StateReader reader(state);
+  Cart& cart = GetCart();
+
+  uint8_t cartType = 0;
+  uint16_t globalChecksum = 0;
+  if (!reader.BeginSection(StateSection::SYSTEM) || !reader.Read(cartType) ||
+      !reader.Read(globalChecksum) || cartType != cart.cartType_ ||
+      globalChecksum != cart.globalChecksum_ ||
+      reader.SectionSize(StateSection::CART_RAM) != cart.ram_.size()) {
+    return false;
+  }
+
+  cpu_.LoadState(reader);
+  timer_.LoadState(reader);
+  io_.LoadState(reader);
+  ppu_.LoadState(reader);
+  addressBus_->LoadState(reader);
+  scheduler_.LoadState(reader);
+  cart.LoadState(reader);
+
+  // anything derived from the bank registers
+  decodeCache_.SelectRomBank(cart.RomBank());
+  addressBus_->MapMemory();
+  lastCycles_ = cpu_.cycles_;
+  idleLoops_.Reset();
+
+  return !reader.failed_;
+}
+
+#ifdef OSTRICH_JIT
+void System::EnableJit(const bool perfMap) {
+  jit_ = std::make_unique<JIT>(cpu_, GetCart(), perfMap);
+}
+#endif
+
+template <typename Mapper>
+GameBoy<Mapper>::GameBoy(std::vector<uint8_t>& romBuffer)
+    : cart_(romBuffer), bus_(cart_) {
+  Connect(cart_, bus_);
+}
+
+template <typename Mapper>
+GameBoy<Mapper>::~GameBoy() {}
+
+template <typename Mapper>
+Cart& GameBoy<Mapper>::GetCart() {
+  return cart_;
+}
+
+// Runs one instruction and whatever events it reaches, false on a cpu error.
+// A halted cpu can only be woken by an interrupt, and every interrupt source
+// is an event, so it skips straight to the m-cycle reaching the next event
+// or until, whichever is first, instead of stepping through the wait.
+template <typename Mapper>
+bool GameBoy<Mapper>::Step(const uint64_t until) {
+  if (cpu_.halted_ && !cpu_.if_) {
+    uint64_t target = std::min(scheduler_.nextEvent_, until);
+    if (target != kSchedulerNever && target > scheduler_.now_ + 4) {
+      // the last m-cycle is left to the step itself
+      cpu_.cycles_ += (target - scheduler_.now_ + 3) / 4 - 1;
+    }
+  }
+
+  uint16_t pc = cpu_.registers_.ProgramCounter();
+
+#ifdef OSTRICH_JIT
+  // compiled blocks must not run past the next event
+  uint64_t budget = (scheduler_.nextEvent_ - scheduler_.now_) / 4;
+  int result = jit_ ? jit_->Step(std::min<uint64_t>(budget, UINT32_MAX))
+                    : cpu_.Step();
+#else
+  int result = cpu_.Step();
+#endif
+  if (result < 0) {
+    return false;
+  }
+
+  // 4 t-cycles every m-cycle
+  scheduler_.now_ += 4 * (cpu_.cycles_ - lastCycles_);
+  lastCycles_ = cpu_.cycles_;
+
+  // a short jump back could be a loop copying memory or polling something
+  uint16_t next = cpu_.registers_.ProgramCounter();
+  if (!cpu_.halted_ && next <= pc && pc - next <= kIdleLoopMaxBytes) {
+    uint64_t skipped =
+        copyLoops_.Run(cpu_, bus_, ppu_, scheduler_, pc, until);
+    if (skipped == 0) {
+      skipped = idleLoops_.Skip(cpu_, ppu_, scheduler_, pc, until);
+    }
+    cpu_.cycles_ += skipped;
+    lastCycles_ = cpu_.cycles_;
+    scheduler_.now_ += 4 * skipped;
+  }
+
+  if (scheduler_.now_ >= scheduler_.nextEvent_) {
+    scheduler_.RunEvents();
+  }
+
+  return true;
+}
+
+// cycles are t-cycles of the master clock
+template <typename Mapper>
+bool GameBoy<Mapper>::RunCycles(const uint64_t cycles) {
+  uint64_t end = scheduler_.now_ + cycles;
+
+  while (scheduler_.now_ < end) {
+    if (!Step(end)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// runs until the ppu starts the next VBLANK
+template <typename Mapper>
+bool GameBoy<Mapper>::RunFrame() {
+  uint64_t frame = ppu_.frames_;
+
+  while (ppu_.frames_ == frame) {
+    if (!Step()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template class GameBoy<Cart>;
+template class GameBoy<MBC1Cart>;
+template class GameBoy<MBC3Cart>;
+
+std::unique_ptr<System> CreateGameBoy(std::vector<uint8_t>& romBuffer) {
+  uint8_t romType = romBuffer[kCartType];
+
+  switch (romType) {
+    case kRomOnly:
+      return std::make_unique<GameBoy<Cart>>(romBuffer);
+    case kMbc1:
+    case kMbc1Ram:
+    case kMbc1RamBattery:
+      return std::make_unique<GameBoy<MBC1Cart>>(romBuffer);
+    case kMbc3:
+    case kMbc3Ram:
+    case kMbc3RamBattery:
+      return std::make_unique<GameBoy<MBC3Cart>>(romBuffer);
+    default:
+      spdlog::warn("Unsupported ROM type: 0x{:X} {}", romType,
+                   RomTypeToString(romType));
+  }
+
+  return nullptr;
+}
+
+std::unique_ptr<System> CreateGameBoy(const std::string& filename) {
+  if (!std::filesystem::exists(filename)) {
+    spdlog::critical("File {} not found", filename);
+    exit(-1);
+  }
+
+  std::vector<uint8_t> romBuffer = LoadRom(filename);
+  return CreateGameBoy(romBuffer);
+}
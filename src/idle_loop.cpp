@@ -0,0 +1,212 @@
+#include "idle_loop.h"
+
+#include <algorithm>
+
+#include "address_bus.h"
+
+// memory the loop may poll, see the class comment
+static bool IsPolledAddress(const uint16_t addr, IdleLoop& loop) {
+  if (addr <= kRomBankEnd || (addr >= kVramStart && addr <= kVramEnd) ||
+      (addr >= kWramStart && addr <= kWramEnd) ||
+      (addr >= kHramStart && addr <= kHramEnd)) {
+    return true;
+  }
+
+  // unlike DIV or the joypad, the other ppu registers only change when
+  // written
+  switch (addr) {
+    case 0xFF44:
+      loop.readsLy = true;
+      return true;
+    case 0xFF41:
+      loop.readsStat = true;
+      return true;
+  }
+
+  return addr >= 0xFF40 && addr <= 0xFF4B;
+}
+
+// adds the source's memory read to cycles, false if the loop can't read it
+static bool ReadsPolledSource(CPU& cpu, const ArgumentType source,
+                              const DecodedInstruction& decoded,
+                              IdleLoop& loop, uint32_t& cycles,
+                              bool& readsA) {
+  Registers& registers = cpu.registers_;
+  uint16_t addr = 0;
+
+  switch (source) {
+    case ArgumentType::NONE:
+    case ArgumentType::B:
+    case ArgumentType::C:
+    case ArgumentType::D:
+    case ArgumentType::E:
+    case ArgumentType::H:
+    case ArgumentType::L:
+    case ArgumentType::IMM_8:
+      return true;
+    case ArgumentType::A:
+      readsA = true;
+      return true;
+    case ArgumentType::MEM_AT_HL:
+      addr = registers.HL();
+      break;
+    case ArgumentType::MEM_AT_BC:
+      addr = registers.BC();
+      break;
+    case ArgumentType::MEM_AT_DE:
+      addr = registers.DE();
+      break;
+    case ArgumentType::MEM_AT_A16:
+      addr = decoded.operand;
+      break;
+    case ArgumentType::MEM_AT_A8:
+      addr = 0xFF00 | (decoded.operand & 0xFF);
+      break;
+    case ArgumentType::MEM_AT_C:
+      addr = 0xFF00 | registers.C();
+      break;
+    default:
+      return false;
+  }
+
+  cycles++;
+  return IsPolledAddress(addr, loop);
+}
+
+IdleLoopDetector::IdleLoopDetector() {}
+
+IdleLoopDetector::~IdleLoopDetector() {}
+
+// Called after a step that jumped back from `from` to the pc, returns the
+// m-cycles of whole iterations that can be skipped without reaching until.
+uint64_t IdleLoopDetector::Skip(CPU& cpu, PPU& ppu, Scheduler& scheduler,
+                                const uint16_t from, const uint64_t until) {
+  uint16_t start = cpu.registers_.ProgramCounter();
+  uint16_t af = cpu.registers_.AF();
+
+  // anything else in between, like an interrupt, changes the cycle count
+  bool consecutive = analyzed_ && loop_.start == start && loop_.cycles != 0 &&
+                     cpu.cycles_ - arrivalCycles_ == loop_.cycles &&
+                     af == arrivalAF_;
+
+  if (!consecutive) {
+    // loops that aren't idle are only checked again once another one runs,
+    // idle ones whenever they're reentered since their code may be in ram
+    if (analyzed_ && loop_.start == start && loop_.cycles == 0) {
+      return 0;
+    }
+
+    loop_ = Analyze(cpu, start);
+    analyzed_ = true;
+  }
+
+  if (loop_.cycles == 0 || from < start || from > loop_.branch) {
+    return 0;
+  }
+
+  uint64_t skipped = 0;
+  if (consecutive) {
+    uint64_t end = std::min({scheduler.nextEvent_, until, ppuStable_});
+
+    uint64_t iterationCycles = 4 * loop_.cycles;
+    if (end != kSchedulerNever && end > scheduler.now_) {
+      skipped = (end - scheduler.now_) / iterationCycles * loop_.cycles;
+    }
+  }
+
+  // the reads in the next iteration will be the ones checked against this
+  arrivalCycles_ = cpu.cycles_ + skipped;
+  arrivalAF_ = af;
+  ppuStable_ = kSchedulerNever;
+  if (loop_.readsStat) {
+    ppuStable_ = ppu.lastSync_ + ppu.CyclesUntilModeEvent();
+  } else if (loop_.readsLy) {
+    ppuStable_ = ppu.lastSync_ + ppu.CyclesUntilLineEnd();
+  }
+
+  return skipped;
+}
+
+// Decodes from start up to the jump back to it, counting the cycles the
+// interpreter would take for one iteration with the jump taken.
+IdleLoop IdleLoopDetector::Analyze(CPU& cpu, const uint16_t start) {
+  IdleLoop loop;
+  loop.start = start;
+
+  uint32_t cycles = 0;
+  bool writesA = false;
+  bool readsA = false;  // before it has been written in the body
+  uint16_t addr = start;
+
+  while (uint16_t(addr - start) <= kIdleLoopMaxBytes) {
+    DecodedInstruction decoded = cpu.Decode(addr);
+    const Instruction& instruction = kInstructions[decoded.opcode];
+    uint16_t next = addr + decoded.length;
+    cycles += decoded.length;
+
+    bool jumpsBack =
+        (instruction.type == InstructionType::JR &&
+         uint16_t(next + int8_t(decoded.operand)) == start) ||
+        (instruction.type == InstructionType::JP &&
+         instruction.source == ArgumentType::IMM_16 &&
+         decoded.operand == start);
+    if (jumpsBack) {
+      // A has to be loaded before it's tested, or never changed at all
+      if (!(readsA && writesA)) {
+        loop.branch = addr;
+        loop.cycles = cycles + 1;
+      }
+      return loop;
+    }
+
+    bool readsAHere = false;
+    ArgumentType source = instruction.source;
+
+    switch (instruction.type) {
+      case InstructionType::NOP:
+        break;
+      case InstructionType::LD:
+      case InstructionType::LDH:
+        if (instruction.destination != ArgumentType::A) {
+          return loop;
+        }
+        break;
+      case InstructionType::CP:
+      case InstructionType::AND:
+      case InstructionType::OR:
+      case InstructionType::XOR:
+      case InstructionType::ADD:
+      case InstructionType::SUB:
+        readsAHere = true;
+        break;
+      case InstructionType::PREFIX_CB:
+        // only BIT, which leaves its operand alone
+        if ((decoded.operand & 0xC0) != 0x40) {
+          return loop;
+        }
+        source = kArgumentTypeFromCBSource[decoded.operand & 0x07];
+        break;
+      default:
+        return loop;
+    }
+
+    if (!ReadsPolledSource(cpu, source, decoded, loop, cycles, readsAHere)) {
+      return loop;
+    }
+
+    readsA |= readsAHere && !writesA;
+    writesA |= instruction.destination == ArgumentType::A ||
+               (instruction.type != InstructionType::CP &&
+                instruction.type != InstructionType::PREFIX_CB &&
+                readsAHere);
+    addr = next;
+  }
+
+  return loop;
+}
+
+// after a state is loaded, nothing seen before can be trusted
+void IdleLoopDetector::Reset() {
+  loop_ = IdleLoop();
+  analyzed_ = false;
+}
@@ -2,6 +2,7 @@
 
 #include <iostream>
 
+#include "cpu.h"
 #include "spdlog/spdlog.h"
 
 IO::IO() {}
@@ -140,3 +141,19 @@ uint8_t IO::GetJoypad() {
 
   return joypad;
 }
+
+// button states come from the frontend, so only the registers are saved
+void IO::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::IO);
+  state.Write(joypad_);
+  state.Write(serialData_);
+  state.Write(serialControl_);
+  state.EndSection();
+}
+
+void IO::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::IO);
+  state.Read(joypad_);
+  state.Read(serialData_);
+  state.Read(serialControl_);
+}
@@ -0,0 +1,385 @@
+#include "jit.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "address_bus.h"
+#include "spdlog/spdlog.h"
+
+// worst case for kJitMaxBlockInstructions, with room to spare
+const uint32_t kJitMaxBlockBytes = 4096;
+
+static bool IsRegisterOrImmediate(ArgumentType type) {
+  switch (type) {
+    case ArgumentType::NONE:
+    case ArgumentType::IMM_16:
+    case ArgumentType::IMM_8:
+    case ArgumentType::A:
+    case ArgumentType::B:
+    case ArgumentType::C:
+    case ArgumentType::D:
+    case ArgumentType::E:
+    case ArgumentType::H:
+    case ArgumentType::L:
+    case ArgumentType::AF:
+    case ArgumentType::BC:
+    case ArgumentType::DE:
+    case ArgumentType::HL:
+    case ArgumentType::SP:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// only instructions that can't observe the rest of the system are compiled
+static bool CanCompile(const Instruction& instruction,
+                       const DecodedInstruction& decoded) {
+  switch (instruction.type) {
+    case InstructionType::NONE:
+    case InstructionType::HALT:
+    case InstructionType::STOP:
+    case InstructionType::DI:
+    case InstructionType::EI:
+    case InstructionType::RET:
+    case InstructionType::RETI:
+    case InstructionType::CALL:
+    case InstructionType::RST:
+    case InstructionType::PUSH:
+    case InstructionType::POP:
+    case InstructionType::LDH:
+    case InstructionType::LD_A16_SP:
+      return false;
+    case InstructionType::PREFIX_CB:
+      // low bits of the CB opcode select the operand, 6 is (HL)
+      return (decoded.operand & 0x07) != 0x06;
+    default:
+      return IsRegisterOrImmediate(instruction.destination) &&
+             IsRegisterOrImmediate(instruction.source);
+  }
+}
+
+// m-cycles a handler may add on top of its fetch
+static uint32_t HandlerExtraCycles(const Instruction& instruction) {
+  switch (instruction.type) {
+    case InstructionType::JP:
+    case InstructionType::JR:
+    case InstructionType::INC16:
+    case InstructionType::DEC16:
+    case InstructionType::ADD16:
+    case InstructionType::LD_HL_SP_R8:
+    case InstructionType::LD_SP_HL:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static void* RegisterField(Registers& registers, ArgumentType type) {
+  switch (type) {
+    case ArgumentType::A:
+      return &registers.A();
+    case ArgumentType::B:
+      return &registers.B();
+    case ArgumentType::C:
+      return &registers.C();
+    case ArgumentType::D:
+      return &registers.D();
+    case ArgumentType::E:
+      return &registers.E();
+    case ArgumentType::H:
+      return &registers.H();
+    case ArgumentType::L:
+      return &registers.L();
+    case ArgumentType::BC:
+      return &registers.BC();
+    case ArgumentType::DE:
+      return &registers.DE();
+    case ArgumentType::HL:
+      return &registers.HL();
+    case ArgumentType::SP:
+      return &registers.StackPointer();
+    default:
+      return nullptr;
+  }
+}
+
+JIT::JIT(CPU& cpu, Cart& cart, bool perfMap)
+    : cpu_(cpu), cart_(cart) {
+  void* code = mmap(nullptr, kJitCodeBufferSize, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED) {
+    spdlog::warn("Failed to allocate JIT code buffer, using interpreter");
+  } else {
+    code_ = static_cast<uint8_t*>(code);
+  }
+
+  // lets perf and friends symbolize compiled blocks
+  if (perfMap) {
+    std::string filename = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+    perfMap_ = fopen(filename.c_str(), "w");
+  }
+}
+
+JIT::~JIT() {
+  if (code_ != nullptr) {
+    munmap(code_, kJitCodeBufferSize);
+  }
+
+  if (perfMap_ != nullptr) {
+    fclose(perfMap_);
+  }
+}
+
+int JIT::Step(const uint32_t maxCycles) {
+  CPU& cpu = cpu_;
+  uint16_t pc = cpu.registers_.ProgramCounter();
+
+  // HALT and pending interrupts go through the interpreter so interrupts are
+  // serviced after exactly the same instruction as before
+  if (code_ == nullptr || pc > kRomBankEnd || cpu.halted_ ||
+      (cpu.ime_ && (cpu.ie_ & cpu.if_ & 0x1F)) ||
+      spdlog::should_log(spdlog::level::trace)) {
+    return cpu.Step();
+  }
+
+  JitBlock* block = FindBlock(pc);
+  if (block->code == nullptr) {
+    if (block->uncompilable || ++block->hits < kJitHotThreshold ||
+        !Compile(*block, pc)) {
+      return cpu.Step();
+    }
+  }
+
+  if (block->maxCycles > maxCycles) {
+    return cpu.Step();
+  }
+
+  block->code(&cpu);
+
+  return 1;
+}
+
+JitBlock* JIT::FindBlock(const uint16_t addr) {
+  uint16_t bank = addr < 0x4000 ? 0 : cart_.RomBank();
+
+  if (bank >= banks_.size()) {
+    banks_.resize(bank + 1);
+  }
+
+  if (banks_[bank] == nullptr) {
+    banks_[bank] = std::make_unique<JitBank>();
+  }
+
+  return &(*banks_[bank])[addr & 0x3FFF];
+}
+
+bool JIT::Compile(JitBlock& block, const uint16_t addr) {
+  if (codeSize_ + kJitMaxBlockBytes > kJitCodeBufferSize) {
+    Flush();
+  }
+
+  mprotect(code_, kJitCodeBufferSize, PROT_READ | PROT_WRITE);
+
+  uint32_t start = codeSize_;
+  uint16_t pc = addr;
+  uint32_t cycles = 0;
+  uint32_t extraCycles = 0;
+  uint32_t count = 0;
+  bool branched = false;
+
+  // push rbx; mov rbx, rdi
+  EmitByte(0x53);
+  EmitByte(0x48);
+  EmitByte(0x89);
+  EmitByte(0xFB);
+
+  while (count < kJitMaxBlockInstructions && !branched) {
+    // stay inside the bank the block was keyed on
+    if ((pc >> 14) != (addr >> 14) || (pc & 0x3FFF) > 0x3FFD) {
+      break;
+    }
+
+    DecodedInstruction decoded = cpu_.Decode(pc);
+    const Instruction& instruction = kInstructions[decoded.opcode];
+    if (!CanCompile(instruction, decoded)) {
+      break;
+    }
+
+    uint16_t next = pc + decoded.length;
+    cycles += decoded.length;
+    branched = instruction.type == InstructionType::JP ||
+               instruction.type == InstructionType::JR;
+
+    // branch handlers work relative to the fallthrough address
+    if (branched) {
+      EmitRegisterMemoryOp({0x66, 0xC7}, 0,
+                           &cpu_.registers_.ProgramCounter());
+      EmitWord(next);
+    }
+
+    if (!EmitNative(instruction, decoded, cycles)) {
+      if (decoded.length > 1) {
+        EmitRegisterMemoryOp({0x66, 0xC7}, 0, &cpu_.operand_);
+        EmitWord(decoded.operand);
+      }
+
+      EmitCall(decoded.handler);
+      extraCycles += HandlerExtraCycles(instruction);
+    }
+
+    pc = next;
+    count++;
+  }
+
+  if (count == 0) {
+    codeSize_ = start;
+    block.uncompilable = true;
+    mprotect(code_, kJitCodeBufferSize, PROT_READ | PROT_EXEC);
+    return false;
+  }
+
+  if (!branched) {
+    EmitRegisterMemoryOp({0x66, 0xC7}, 0, &cpu_.registers_.ProgramCounter());
+    EmitWord(pc);
+  }
+
+  // add qword [cycles_], cycles
+  EmitRegisterMemoryOp({0x48, 0x81}, 0, &cpu_.cycles_);
+  EmitDoubleWord(cycles);
+
+  // pop rbx; ret
+  EmitByte(0x5B);
+  EmitByte(0xC3);
+
+  mprotect(code_, kJitCodeBufferSize, PROT_READ | PROT_EXEC);
+
+  block.code = reinterpret_cast<JitBlockFunction>(code_ + start);
+  block.maxCycles = cycles + extraCycles;
+  compiledBlocks_++;
+
+  if (perfMap_ != nullptr) {
+    fprintf(perfMap_, "%lx %x ostrich_jit_%02X_%04X\n",
+            reinterpret_cast<uintptr_t>(code_ + start), codeSize_ - start,
+            addr < 0x4000 ? 0 : cart_.RomBank(), addr);
+    fflush(perfMap_);
+  }
+
+  return true;
+}
+
+void JIT::Flush() {
+  spdlog::debug("JIT code buffer full, flushing {} blocks", compiledBlocks_);
+
+  for (auto& bank : banks_) {
+    if (bank != nullptr) {
+      bank->fill(JitBlock{});
+    }
+  }
+
+  codeSize_ = 0;
+  compiledBlocks_ = 0;
+}
+
+void JIT::EmitByte(const uint8_t byte) { code_[codeSize_++] = byte; }
+
+void JIT::EmitWord(const uint16_t word) {
+  EmitByte(word & 0xFF);
+  EmitByte(word >> 8);
+}
+
+void JIT::EmitDoubleWord(const uint32_t doubleWord) {
+  EmitWord(doubleWord & 0xFFFF);
+  EmitWord(doubleWord >> 16);
+}
+
+void JIT::EmitQuadWord(const uint64_t quadWord) {
+  EmitDoubleWord(quadWord & 0xFFFFFFFF);
+  EmitDoubleWord(quadWord >> 32);
+}
+
+// emits <prefix> with a [rbx + disp32] operand addressing a field of the cpu
+void JIT::EmitRegisterMemoryOp(const std::vector<uint8_t>& prefix,
+                               const uint8_t reg, const void* field) {
+  for (auto byte : prefix) {
+    EmitByte(byte);
+  }
+
+  EmitByte(0x83 | (reg << 3));
+  EmitDoubleWord(static_cast<const uint8_t*>(field) -
+                 reinterpret_cast<const uint8_t*>(&cpu_));
+}
+
+void JIT::EmitCall(const OpcodeHandler handler) {
+  // mov rdi, rbx; mov rax, handler; call rax
+  EmitByte(0x48);
+  EmitByte(0x89);
+  EmitByte(0xDF);
+  EmitByte(0x48);
+  EmitByte(0xB8);
+  EmitQuadWord(reinterpret_cast<uint64_t>(handler));
+  EmitByte(0xFF);
+  EmitByte(0xD0);
+}
+
+// handles the flagless loads and jumps directly, everything else calls the
+// interpreter's handler
+bool JIT::EmitNative(const Instruction& instruction,
+                     const DecodedInstruction& decoded, uint32_t& cycles) {
+  Registers& registers = cpu_.registers_;
+  void* destination = RegisterField(registers, instruction.destination);
+  void* source = RegisterField(registers, instruction.source);
+
+  switch (instruction.type) {
+    case InstructionType::NOP:
+      return true;
+    case InstructionType::LD:
+      if (destination == nullptr) {
+        return false;
+      }
+
+      if (instruction.source == ArgumentType::IMM_8) {
+        // mov byte [destination], imm8
+        EmitRegisterMemoryOp({0xC6}, 0, destination);
+        EmitByte(decoded.operand & 0xFF);
+        return true;
+      }
+
+      // mov al, [source]; mov [destination], al
+      EmitRegisterMemoryOp({0x8A}, 0, source);
+      EmitRegisterMemoryOp({0x88}, 0, destination);
+      return true;
+    case InstructionType::LD_16:
+      // mov word [destination], imm16
+      EmitRegisterMemoryOp({0x66, 0xC7}, 0, destination);
+      EmitWord(decoded.operand);
+      return true;
+    case InstructionType::LD_SP_HL:
+      // mov ax, [hl]; mov [sp], ax
+      EmitRegisterMemoryOp({0x66, 0x8B}, 0, &registers.HL());
+      EmitRegisterMemoryOp({0x66, 0x89}, 0, &registers.StackPointer());
+      cycles++;
+      return true;
+    case InstructionType::INC16:
+    case InstructionType::DEC16:
+      // inc/dec word [source]
+      EmitRegisterMemoryOp(
+          {0x66, 0xFF}, instruction.type == InstructionType::INC16 ? 0 : 1,
+          source);
+      cycles++;
+      return true;
+    case InstructionType::JP:
+      if (instruction.condition != ConditionType::NONE ||
+          instruction.source != ArgumentType::IMM_16) {
+        return false;
+      }
+
+      // mov word [pc], imm16
+      EmitRegisterMemoryOp({0x66, 0xC7}, 0, &registers.ProgramCounter());
+      EmitWord(decoded.operand);
+      cycles++;
+      return true;
+    default:
+      return false;
+  }
+}
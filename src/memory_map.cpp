@@ -0,0 +1,29 @@
+#include "memory_map.h"
+
+MemoryMap::MemoryMap() {}
+
+MemoryMap::~MemoryMap() {}
+
+// start and end are inclusive and page aligned, data covers the whole range
+void MemoryMap::Map(const uint16_t start, const uint16_t end,
+                    const uint8_t* data) {
+  for (uint32_t page = start / kPageSize; page <= end / kPageSize; page++) {
+    read_[page] = data + (page * kPageSize - start);
+    write_[page] = nullptr;
+  }
+}
+
+void MemoryMap::MapWritable(const uint16_t start, const uint16_t end,
+                            uint8_t* data) {
+  for (uint32_t page = start / kPageSize; page <= end / kPageSize; page++) {
+    read_[page] = data + (page * kPageSize - start);
+    write_[page] = data + (page * kPageSize - start);
+  }
+}
+
+void MemoryMap::Unmap(const uint16_t start, const uint16_t end) {
+  for (uint32_t page = start / kPageSize; page <= end / kPageSize; page++) {
+    read_[page] = nullptr;
+    write_[page] = nullptr;
+  }
+}
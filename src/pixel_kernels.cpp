@@ -0,0 +1,253 @@
+#include "pixel_kernels.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+static void ApplyPaletteScalar(const uint8_t* indices, const uint8_t* palette,
+                               uint8_t* out, const size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = palette[indices[i] & 0b11];
+  }
+}
+
+static void ExpandColorsScalar(const uint8_t* shades, const uint32_t* colors,
+                               uint32_t* out, const size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    out[i] = colors[shades[i] & 0b11];
+  }
+}
+
+#if defined(__SSE2__)
+
+// each byte lane tests one bit, msb first so lane 0 is the leftmost pixel
+void DecodeTileRow(const uint8_t low, const uint8_t high, const bool xFlip,
+                   uint8_t* indices) {
+  const __m128i bits =
+      xFlip ? _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0,
+                            0)
+            : _mm_setr_epi8(-128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0,
+                            0);
+
+  __m128i lowSet = _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(low), bits), bits);
+  __m128i highSet =
+      _mm_cmpeq_epi8(_mm_and_si128(_mm_set1_epi8(high), bits), bits);
+  __m128i result = _mm_or_si128(_mm_and_si128(lowSet, _mm_set1_epi8(1)),
+                                _mm_and_si128(highSet, _mm_set1_epi8(2)));
+
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(indices), result);
+}
+
+#if defined(__AVX2__)
+
+// pshufb does the 4 entry lookup, 32 pixels at a time, then a tile's 8 at a
+// time for the fifo renderer's single rows
+void ApplyPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* out,
+                  const size_t count) {
+  const __m256i table = _mm256_setr_epi8(
+      palette[0], palette[1], palette[2], palette[3], 0, 0, 0, 0, 0, 0, 0, 0, 0,
+      0, 0, 0, palette[0], palette[1], palette[2], palette[3], 0, 0, 0, 0, 0, 0,
+      0, 0, 0, 0, 0, 0);
+  const __m256i mask = _mm256_set1_epi8(0b11);
+
+  size_t i = 0;
+  for (; i + 32 <= count; i += 32) {
+    __m256i in =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_shuffle_epi8(table, _mm256_and_si256(in, mask)));
+  }
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i in = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                     _mm_shuffle_epi8(_mm256_castsi256_si128(table),
+                                      _mm_and_si128(in, _mm_set1_epi8(0b11))));
+  }
+
+  ApplyPaletteScalar(indices + i, palette, out + i, count - i);
+}
+
+// vpermd picks each pixel's color straight out of a register
+void ExpandColors(const uint8_t* shades, const uint32_t* colors, uint32_t* out,
+                  const size_t count) {
+  const __m256i table = _mm256_setr_epi32(colors[0], colors[1], colors[2],
+                                          colors[3], 0, 0, 0, 0);
+  const __m256i mask = _mm256_set1_epi32(0b11);
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i in = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(shades + i)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(out + i),
+        _mm256_permutevar8x32_epi32(table, _mm256_and_si256(in, mask)));
+  }
+
+  ExpandColorsScalar(shades + i, colors, out + i, count - i);
+}
+
+const char* PixelKernelsName() { return "avx2"; }
+
+#else
+
+// no byte shuffle in sse2, so select each of the 4 entries with a compare
+static __m128i LookupPalette(const __m128i indices, const uint8_t* palette) {
+  __m128i in = _mm_and_si128(indices, _mm_set1_epi8(0b11));
+  __m128i result = _mm_setzero_si128();
+
+  for (int entry = 0; entry < 4; entry++) {
+    __m128i match = _mm_cmpeq_epi8(in, _mm_set1_epi8(entry));
+    result = _mm_or_si128(result,
+                          _mm_and_si128(match, _mm_set1_epi8(palette[entry])));
+  }
+
+  return result;
+}
+
+// 16 pixels at a time, then a tile's 8 for the fifo renderer's single rows
+void ApplyPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* out,
+                  const size_t count) {
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     LookupPalette(in, palette));
+  }
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i in = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + i),
+                     LookupPalette(in, palette));
+  }
+
+  ApplyPaletteScalar(indices + i, palette, out + i, count - i);
+}
+
+void ExpandColors(const uint8_t* shades, const uint32_t* colors, uint32_t* out,
+                  const size_t count) {
+  const __m128i mask = _mm_set1_epi32(0b11);
+  const __m128i zero = _mm_setzero_si128();
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint32_t packed;
+    __builtin_memcpy(&packed, shades + i, 4);
+    __m128i in = _mm_cvtsi32_si128(packed);
+    in = _mm_and_si128(
+        _mm_unpacklo_epi16(_mm_unpacklo_epi8(in, zero), zero), mask);
+    __m128i result = _mm_setzero_si128();
+
+    for (int entry = 0; entry < 4; entry++) {
+      __m128i match = _mm_cmpeq_epi32(in, _mm_set1_epi32(entry));
+      result = _mm_or_si128(
+          result, _mm_and_si128(match, _mm_set1_epi32(colors[entry])));
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), result);
+  }
+
+  ExpandColorsScalar(shades + i, colors, out + i, count - i);
+}
+
+const char* PixelKernelsName() { return "sse2"; }
+
+#endif
+
+#elif defined(__wasm_simd128__)
+
+void DecodeTileRow(const uint8_t low, const uint8_t high, const bool xFlip,
+                   uint8_t* indices) {
+  const v128_t bits =
+      xFlip ? wasm_u8x16_make(1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0,
+                              0)
+            : wasm_u8x16_make(128, 64, 32, 16, 8, 4, 2, 1, 0, 0, 0, 0, 0, 0, 0,
+                              0);
+
+  v128_t lowSet = wasm_i8x16_eq(wasm_v128_and(wasm_u8x16_splat(low), bits), bits);
+  v128_t highSet =
+      wasm_i8x16_eq(wasm_v128_and(wasm_u8x16_splat(high), bits), bits);
+  v128_t result = wasm_v128_or(wasm_v128_and(lowSet, wasm_u8x16_splat(1)),
+                               wasm_v128_and(highSet, wasm_u8x16_splat(2)));
+
+  wasm_v128_store64_lane(indices, result, 0);
+}
+
+// swizzle does the 4 entry lookup like pshufb, a tile's 8 pixels at a time
+// once fewer than 16 are left
+void ApplyPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* out,
+                  const size_t count) {
+  const v128_t table =
+      wasm_u8x16_make(palette[0], palette[1], palette[2], palette[3], 0, 0, 0,
+                      0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const v128_t mask = wasm_u8x16_splat(0b11);
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    v128_t in = wasm_v128_and(wasm_v128_load(indices + i), mask);
+    wasm_v128_store(out + i, wasm_i8x16_swizzle(table, in));
+  }
+
+  for (; i + 8 <= count; i += 8) {
+    v128_t in = wasm_v128_and(wasm_v128_load64_zero(indices + i), mask);
+    wasm_v128_store64_lane(out + i, wasm_i8x16_swizzle(table, in), 0);
+  }
+
+  ApplyPaletteScalar(indices + i, palette, out + i, count - i);
+}
+
+// swizzles the 4 bytes of each pixel's color out of the table
+void ExpandColors(const uint8_t* shades, const uint32_t* colors, uint32_t* out,
+                  const size_t count) {
+  const v128_t table = wasm_v128_load(colors);
+  const v128_t byteOffsets =
+      wasm_u8x16_make(0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    v128_t in = wasm_v128_and(wasm_v128_load32_zero(shades + i),
+                              wasm_u8x16_splat(0b11));
+    // repeat each shade across its pixel's 4 bytes, then scale to a byte index
+    v128_t spread = wasm_i8x16_swizzle(
+        in, wasm_u8x16_make(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3));
+    v128_t index = wasm_i8x16_add(wasm_i8x16_shl(spread, 2), byteOffsets);
+    wasm_v128_store(out + i, wasm_i8x16_swizzle(table, index));
+  }
+
+  ExpandColorsScalar(shades + i, colors, out + i, count - i);
+}
+
+const char* PixelKernelsName() { return "wasm simd"; }
+
+#else
+
+static void DecodeTileRowScalar(const uint8_t low, const uint8_t high,
+                                const bool xFlip, uint8_t* indices) {
+  for (int x = 0; x < 8; x++) {
+    uint8_t bit = xFlip ? x : 7 - x;
+    indices[x] = (((high >> bit) & 0x01) << 1) | ((low >> bit) & 0x01);
+  }
+}
+
+void DecodeTileRow(const uint8_t low, const uint8_t high, const bool xFlip,
+                   uint8_t* indices) {
+  DecodeTileRowScalar(low, high, xFlip, indices);
+}
+
+void ApplyPalette(const uint8_t* indices, const uint8_t* palette, uint8_t* out,
+                  const size_t count) {
+  ApplyPaletteScalar(indices, palette, out, count);
+}
+
+void ExpandColors(const uint8_t* shades, const uint32_t* colors, uint32_t* out,
+                  const size_t count) {
+  ExpandColorsScalar(shades, colors, out, count);
+}
+
+const char* PixelKernelsName() { return "scalar"; }
+
+#endif
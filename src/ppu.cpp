@@ -1,5 +1,10 @@
 #include "ppu.h"
 
+#include <algorithm>
+
+#include "address_bus.h"
+#include "cpu.h"
+#include "pixel_kernels.h"
 #include "spdlog/spdlog.h"
 
 PPU::PPU() { SetMode(OAM_SCAN); }
@@ -20,24 +25,35 @@ void PPU::Tick() {
         SetMode(PIXEL_TRANSFER);
 
         ResetPixelPipeline();
+
+        if (scanline_) {
+          pixelTransferEnd_ = PixelTransferEnd();
+        }
       }
 
       // scan OAM for sprites, using the first 40 cycles as the index to check
       /* if (cycles_ < 40) { */
       if (cycles_ == 1) {
-        spritesInLine_ = {};
         ScanOAM(cycles_);
       }
 
       break;
     case PIXEL_TRANSFER:  // process and push pixels
-      ProcessPixelPipeline();
+      if (!scanline_) {
+        ProcessPixelPipeline();
+      } else if (cycles_ >= pixelTransferEnd_) {
+        lcdPushedX_ = kLCDWidth;
+      }
 
       if (lcdPushedX_ >= kLCDWidth) {  // xres pixels sent
+        if (scanline_ && !skipRender_) {
+          RenderScanline();
+        }
+
         SetMode(HBLANK);
 
         if (GetLCDStat(kLCDStatIntHBlank)) {
-          interruptHandler_->Request(kInterruptLCD);
+          cpu_->Request(kInterruptLCD);
         }
       }
       break;
@@ -48,13 +64,22 @@ void PPU::Tick() {
         if (ly_ >= kLCDHeight) {  // line is now outside the visible screen
           SetMode(VBLANK);
 
-          interruptHandler_->Request(kInterruptVBlank);
+          cpu_->Request(kInterruptVBlank);
 
           if (GetLCDStat(kLCDStatIntVBlank)) {
-            interruptHandler_->Request(kInterruptLCD);
+            cpu_->Request(kInterruptLCD);
           }
 
           frames_++;
+
+          if (!skipRender_) {
+            frameBuffers_.Publish();
+            screenBuffer_ = frameBuffers_.Back();
+          }
+
+          if (scheduler_ != nullptr) {
+            scheduler_->Schedule(EventType::FRAME_END, lastSync_);
+          }
         } else {
           SetMode(OAM_SCAN);
         }
@@ -90,7 +115,7 @@ void PPU::MoveToNextLine() {
     SetLCDStat(kLCDStatLyc);
 
     if (GetLCDStat(kLCDStatIntLyc)) {
-      interruptHandler_->Request(kInterruptLCD);
+      cpu_->Request(kInterruptLCD);
     }
   } else {
     ClearLCDStat(kLCDStatLyc);
@@ -99,35 +124,39 @@ void PPU::MoveToNextLine() {
 
 void PPU::ScanOAM(const uint8_t index) {
   uint8_t spriteHeight = GetSpriteHeight();
-  spritesInLine_ = {};
+  spritesInLine_.clear();
 
   for (auto& oamEntry : oam_) {
     if (oamEntry.x == 0) {  // skip invisible sprite
       continue;
     }
 
-    if (spritesInLine_.size() >= 10) {
+    if (spritesInLine_.size() >= kMaxSpritesPerLine) {
       break;
     }
 
     if (oamEntry.y <= ly_ + 16 && oamEntry.y + spriteHeight > ly_ + 16) {
-      spritesInLine_.push_back(oamEntry);
+      // keep the line sorted by descending x, ahead of earlier entries with
+      // the same x so those end up drawn last
+      size_t index = 0;
+      while (index < spritesInLine_.size() &&
+             spritesInLine_[index].x > oamEntry.x) {
+        index++;
+      }
+      spritesInLine_.insert(index, oamEntry);
     }
   }
-
-  std::stable_sort(
-      spritesInLine_.begin(), spritesInLine_.end(),
-      [](const OAMData& a, const OAMData& b) { return a.x >= b.x; });
 }
 
 void PPU::ResetPixelPipeline() {
-  backgroundFIFO_ = {};
-  spriteFIFO_ = {};
+  backgroundFIFO_.clear();
+  spriteFIFO_.clear();
 
   // background fetcher state
   fetchStep_ = TILE;
   fetcherX_ = 0;
   lcdPushedX_ = 0;
+  lcdFlushedX_ = 0;
   lcdLineX_ = 0;
   fifoPushedX_ = 0;
 }
@@ -177,7 +206,7 @@ void PPU::FetchTile() {
       addr = GetBackgroundTileMapArea() + (mapX / 8) + (mapY / 8) * 32;
     }
 
-    tileNumber_ = memory_->Read(addr);
+    tileNumber_ = vram_[addr - 0x8000];
     if (!GetLCDControl(
             kLCDControlBGWinTileDataAreaSelect)) {  // offset address based on
                                                     // addressing mode for tile
@@ -185,7 +214,7 @@ void PPU::FetchTile() {
     }
   }
 
-  fetchedSprites_ = {};
+  fetchedSprites_.clear();
 
   // this may need to be in its own pipeline
   if (GetLCDControl(kLCDControlObjEnable) && spritesInLine_.size() > 0) {
@@ -208,64 +237,39 @@ void PPU::FetchTile() {
 void PPU::FetchTileDataLow() {
   uint8_t mapY = ly_ + scy_;
   uint8_t tileY = (mapY % 8) * 2;
-  uint16_t addr = GetTileDataArea() + (tileNumber_ * 16) + tileY;
-
-  tileDataLow_ = memory_->Read(addr);
-
-  // fetch sprite low bytes
-  oamDataLow_ = {};
-  oamDataLow_.reserve(fetchedSprites_.size());
-
-  uint8_t spriteHeight = GetSpriteHeight();
-  for (int i = 0; i < fetchedSprites_.size(); i++) {
-    uint8_t tileY = ((ly_ + 16) - fetchedSprites_[i].y) * 2;
-
-    if (fetchedSprites_[i].yFlip) {
-      tileY = (spriteHeight * 2) - 2 - tileY;
-    }
-
-    uint8_t tileIndex = fetchedSprites_[i].tileIndex;
-
-    if (spriteHeight == 16) {
-      tileIndex &= ~(0x01);
-    }
-
-    oamDataLow_[i] = memory_->Read(kLCDSpriteDataArea + tileIndex * 16 + tileY);
-  }
+  tileRowOffset_ = GetTileDataArea() + (tileNumber_ * 16) + tileY - 0x8000;
 
   fetchStep_ = DATAHIGH;
 }
 
+// both bit planes are in by now, take the decoded rows from the tile cache
 void PPU::FetchTileDataHigh() {
-  uint8_t mapY = ly_ + scy_;
-  uint8_t tileY = (mapY % 8) * 2;
-  uint16_t addr = GetTileDataArea() + (tileNumber_ * 16) + tileY + 1;
+  tileRow_ = tileCache_.Row(vram_, tileRowOffset_, false);
 
-  tileDataHigh_ = memory_->Read(addr);
+  for (size_t i = 0; i < fetchedSprites_.size(); i++) {
+    spriteRows_[i] = tileCache_.Row(vram_, SpriteRowOffset(fetchedSprites_[i]),
+                                    fetchedSprites_[i].xFlip);
+  }
 
-  // fetch sprite high bytes
-  oamDataHigh_ = {};
-  oamDataHigh_.reserve(fetchedSprites_.size());
+  fetchStep_ = SLEEP;
+}
 
+// VRAM offset of the sprite's row on the current line
+uint16_t PPU::SpriteRowOffset(const OAMData& sprite) {
   uint8_t spriteHeight = GetSpriteHeight();
-  for (int i = 0; i < fetchedSprites_.size(); i++) {
-    uint8_t tileY = ((ly_ + 16) - fetchedSprites_[i].y) * 2;
+  uint8_t tileY = ((ly_ + 16) - sprite.y) * 2;
 
-    if (fetchedSprites_[i].yFlip) {
-      tileY = (spriteHeight * 2) - 2 - tileY;
-    }
+  if (sprite.yFlip) {
+    tileY = (spriteHeight * 2) - 2 - tileY;
+  }
 
-    uint8_t tileIndex = fetchedSprites_[i].tileIndex;
+  uint8_t tileIndex = sprite.tileIndex;
 
-    if (spriteHeight == 16) {
-      tileIndex &= ~(0x01);
-    }
-
-    oamDataHigh_[i] =
-        memory_->Read(kLCDSpriteDataArea + tileIndex * 16 + tileY + 1);
+  if (spriteHeight == 16) {
+    tileIndex &= ~(0x01);
   }
 
-  fetchStep_ = SLEEP;
+  return tileIndex * 16 + tileY;
 }
 
 void PPU::FetchSleep() { fetchStep_ = PUSH; }
@@ -275,20 +279,21 @@ void PPU::PushToFIFO() {
     return;
   }
 
-  for (int i = 7; i >= 0; i--) {
-    bool setLow = tileDataLow_ & (0x01 << i);
-    bool setHigh = tileDataHigh_ & (0x01 << i);
-    uint8_t colorIndex = (setHigh << 1) | setLow;
-    uint8_t color = backgroundPalette_[0];
+  uint8_t colors[8];
+  if (GetLCDControl(kLCDControlBGWinEnable)) {
+    ApplyPalette(tileRow_.data(), backgroundPalette_, colors, 8);
+  } else {
+    std::fill_n(colors, 8, backgroundPalette_[0]);
+  }
 
-    if (GetLCDControl(kLCDControlBGWinEnable)) {
-      color = backgroundPalette_[colorIndex];
-    }
+  for (int x = 0; x < 8; x++) {
+    uint8_t colorIndex = tileRow_[x];
+    uint8_t color = colors[x];
 
     // rather than mixing separately, just decide on the sprite pixel to show
     // here
     if (GetLCDControl(kLCDControlObjEnable)) {
-      for (int i = 0; i < fetchedSprites_.size(); i++) {
+      for (size_t i = 0; i < fetchedSprites_.size(); i++) {
         int spriteX = (fetchedSprites_[i].x - 8) + scx_ % 8;
         if (fifoPushedX_ > (spriteX + 8)) {
           continue;
@@ -299,14 +304,8 @@ void PPU::PushToFIFO() {
           continue;
         }
 
-        uint8_t bit = 7 - offset;
-        if (fetchedSprites_[i].xFlip) {
-          bit = offset;
-        }
-
-        bool low = oamDataLow_[i] & (0x01 << bit);
-        bool high = oamDataHigh_[i] & (0x01 << bit);
-        uint8_t spriteColorIndex = (high << 1) | low;
+        // rows are already mirrored for X-flipped sprites
+        uint8_t spriteColorIndex = spriteRows_[i][offset];
 
         if (spriteColorIndex == 0) {
           continue;  // ignore transparent color
@@ -374,15 +373,122 @@ void PPU::PushPixelToLCD() {
     backgroundFIFO_.pop();
 
     if (lcdLineX_ >= (scx_ % 8)) {
-      screenBuffer_[lcdPushedX_ + ly_ * kLCDWidth] = kDefaultColors[colorIndex];
-
+      lineShades_[lcdPushedX_] = colorIndex;
       lcdPushedX_++;
+
+      if (lcdPushedX_ % 8 == 0) {
+        FlushPushedPixels();
+      }
     }
 
     lcdLineX_++;
   }
 }
 
+// Colors the pixels pushed since the last flush onto the screen, 8 at a time
+// as they come out of the fifo, or before a register write that could move
+// the rest of the line elsewhere.
+void PPU::FlushPushedPixels() {
+  // ly is writable, so it isn't always on screen
+  if (!scanline_ && ly_ < kLCDHeight && !skipRender_ &&
+      lcdFlushedX_ < lcdPushedX_) {
+    ExpandColors(&lineShades_[lcdFlushedX_], kDefaultColors,
+                 screenBuffer_ + ly_ * kLCDWidth + lcdFlushedX_,
+                 lcdPushedX_ - lcdFlushedX_);
+  }
+
+  lcdFlushedX_ = lcdPushedX_;
+}
+
+// Dot of the line where the fifo would push its last pixel. The fetcher
+// steps on odd dots and takes 10 dots per 8 pixels once the fifo is primed,
+// and the first scx % 8 pixels popped are dropped.
+uint32_t PPU::PixelTransferEnd() {
+  uint32_t firstFetch = cycles_ + (cycles_ % 2 ? 2 : 1);
+  uint32_t pops = scx_ % 8 + kLCDWidth;
+
+  return firstFetch + 18 + 10 * ((pops - 1) / 8) + (pops - 1) % 8;
+}
+
+// Produces the pixels the fifo would have pushed for this line, one fetch of
+// 8 at a time, from the registers as they are at the end of pixel transfer.
+void PPU::RenderScanline() {
+  if (ly_ >= kLCDHeight) {
+    return;
+  }
+
+  uint8_t fineX = scx_ % 8;
+  uint8_t mapY = ly_ + scy_;
+  uint8_t tileY = (mapY % 8) * 2;
+  uint32_t entries = fineX + kLCDWidth;  // leading fineX pixels are dropped
+
+  uint8_t colorIndices[kLCDWidth + 8];
+  uint8_t colors[kLCDWidth + 8];
+
+  uint32_t fetch = 0;
+  for (; fetch * 8 < entries; fetch++) {
+    uint8_t fetcherX = fetch * 8;
+    const TileRow* row = &kBlankTileRow;
+
+    if (GetLCDControl(kLCDControlBGWinEnable)) {
+      uint16_t addr = 0x00;
+
+      if (WindowIsVisible() && fetcherX + 7 >= wx_ &&
+          fetcherX < wx_ + 7 + kLCDHeight && ly_ >= wy_ &&
+          ly_ < wy_ + kLCDWidth) {
+        uint8_t windowTileY = windowY_ / 8;
+        addr = GetWindowTileMapArea() + (fetcherX - wx_ + 7) / 8 +
+               windowTileY * 32;
+      } else {
+        uint8_t mapX = fetcherX + scx_;
+        addr = GetBackgroundTileMapArea() + (mapX / 8) + (mapY / 8) * 32;
+      }
+
+      uint8_t tileNumber = vram_[addr - 0x8000];
+      if (!GetLCDControl(kLCDControlBGWinTileDataAreaSelect)) {
+        tileNumber += 128;
+      }
+
+      uint16_t tileAddr = GetTileDataArea() + (tileNumber * 16) + tileY;
+      row = &tileCache_.Row(vram_, tileAddr - 0x8000, false);
+    }
+
+    std::copy(row->begin(), row->end(), colorIndices + fetcherX);
+  }
+
+  ApplyPalette(colorIndices, backgroundPalette_, colors, fetch * 8);
+
+  // sprites later in the line's list win, like in PushToFIFO
+  if (GetLCDControl(kLCDControlObjEnable)) {
+    for (auto& sprite : spritesInLine_) {
+      int spriteX = (sprite.x - 8) + fineX;
+      const TileRow& row =
+          tileCache_.Row(vram_, SpriteRowOffset(sprite), sprite.xFlip);
+
+      for (int offset = 0; offset < 8; offset++) {
+        int entry = spriteX + offset;
+        if (entry < 0 || entry >= (int)entries) {
+          continue;
+        }
+
+        uint8_t spriteColorIndex = row[offset];
+
+        if (spriteColorIndex == 0) {
+          continue;  // ignore transparent color
+        }
+
+        if (!sprite.priority || colorIndices[entry] == 0) {
+          colors[entry] = sprite.palette ? sprite2Palette_[spriteColorIndex]
+                                         : sprite1Palette_[spriteColorIndex];
+        }
+      }
+    }
+  }
+
+  ExpandColors(colors + fineX, kDefaultColors, screenBuffer_ + ly_ * kLCDWidth,
+               kLCDWidth);
+}
+
 void PPU::DMAInit(const uint8_t start) {
   dmaActive_ = true;
   dmaByte_ = 0;
@@ -410,7 +516,136 @@ void PPU::DMAProcess() {
   }
 }
 
+void PPU::HandleEvent(const EventType /*type*/) { Sync(); }
+
+void PPU::Sync() {
+  if (scheduler_ == nullptr || syncing_) {
+    return;
+  }
+
+  syncing_ = true;
+
+  while (lastSync_ < scheduler_->now_) {
+    uint64_t dots = std::min<uint64_t>(
+        std::min(CyclesUntilModeEvent(), CyclesUntilDMA()),
+        scheduler_->now_ - lastSync_);
+
+    // the dots before an event only move the line position along
+    cycles_ += dots - 1;
+    lastSync_ += dots;
+    Tick();
+  }
+
+  syncing_ = false;
+
+  ScheduleEvents();
+}
+
+void PPU::ScheduleEvents() {
+  if (scheduler_ == nullptr) {
+    return;
+  }
+
+  scheduler_->Schedule(
+      EventType::PPU_MODE,
+      lastSync_ + (catchUp_ ? CyclesUntilInterrupt() : CyclesUntilModeEvent()));
+
+  if (dmaActive_) {
+    scheduler_->Schedule(EventType::DMA, lastSync_ + CyclesUntilDMA());
+  } else {
+    scheduler_->Cancel(EventType::DMA);
+  }
+}
+
+// dots until the next Tick that can change anything visible outside the ppu
+uint32_t PPU::CyclesUntilModeEvent() {
+  uint32_t target = kCyclesPerLine;
+
+  switch (GetMode()) {
+    case OAM_SCAN:
+      target = cycles_ == 0 ? 1 : kCyclesPerOamScan;
+      break;
+    case PIXEL_TRANSFER:
+      if (!scanline_) {
+        return 1;
+      }
+
+      target = pixelTransferEnd_;
+      break;
+    case HBLANK:
+    case VBLANK:
+      break;
+  }
+
+  return cycles_ < target ? target - cycles_ : 1;
+}
+
+// lower bound on the dots until the ppu can next request an interrupt or
+// finish a frame, everything else waits for the next access
+uint32_t PPU::CyclesUntilInterrupt() {
+  if (GetLCDStat(kLCDStatIntHBlank)) {
+    switch (GetMode()) {
+      case OAM_SCAN:
+        return CyclesUntilModeEvent();
+      case PIXEL_TRANSFER:
+        if (scanline_) {
+          return CyclesUntilModeEvent();
+        }
+
+        // at most one pixel is pushed per dot
+        return lcdPushedX_ < kLCDWidth ? kLCDWidth - lcdPushedX_ : 1;
+      default:
+        break;
+    }
+  }
+
+  // LYC, VBLANK and the frame end all happen as a line ends
+  return CyclesUntilLineEnd();
+}
+
+// dots until LY next changes
+uint32_t PPU::CyclesUntilLineEnd() {
+  return cycles_ < kCyclesPerLine ? kCyclesPerLine - cycles_ : 1;
+}
+
+// lower bound on the dots until the ppu next reads vram, which it only does
+// while drawing a line
+uint32_t PPU::CyclesUntilVramRead() {
+  switch (GetMode()) {
+    case OAM_SCAN:
+      return cycles_ < kCyclesPerOamScan ? kCyclesPerOamScan - cycles_ : 1;
+    case PIXEL_TRANSFER:
+      // the scanline renderer reads it all as the transfer ends
+      if (scanline_ && cycles_ < pixelTransferEnd_) {
+        return pixelTransferEnd_ - cycles_;
+      }
+      return 1;
+    case HBLANK:
+      if (ly_ + 1u < kLCDHeight) {
+        return CyclesUntilLineEnd() + kCyclesPerOamScan;
+      }
+      return CyclesUntilLineEnd() +
+             (kLinesPerFrame - kLCDHeight) * kCyclesPerLine +
+             kCyclesPerOamScan;
+    case VBLANK:
+      return CyclesUntilLineEnd() +
+             (kLinesPerFrame - 1 - ly_) * kCyclesPerLine + kCyclesPerOamScan;
+  }
+
+  return 1;
+}
+
+uint32_t PPU::CyclesUntilDMA() {
+  if (!dmaActive_) {
+    return UINT32_MAX;
+  }
+
+  return 4 - cycles_ % 4;
+}
+
 const uint8_t PPU::Read(const uint16_t addr) {
+  Sync();
+
   if (addr >= 0x8000 && addr < 0xA000) {
     return vram_[addr - 0x8000];
   }
@@ -455,8 +690,11 @@ const uint8_t PPU::Read(const uint16_t addr) {
 }
 
 void PPU::Write(const uint16_t addr, const uint8_t value) {
+  Sync();
+
   if (addr >= 0x8000 && addr < 0xA000) {
     vram_[addr - 0x8000] = value;
+    tileCache_.Invalidate(addr - 0x8000);
     return;
   }
 
@@ -473,7 +711,9 @@ void PPU::Write(const uint16_t addr, const uint8_t value) {
       lcdc_ = value;
       return;
     case 0xFF41:
+      FlushPushedPixels();
       stat_ = value;
+      ScheduleEvents();  // the mode bits are writable
       return;
     case 0xFF42:
       scy_ = value;
@@ -482,6 +722,7 @@ void PPU::Write(const uint16_t addr, const uint8_t value) {
       scx_ = value;
       return;
     case 0xFF44:
+      FlushPushedPixels();
       ly_ = value;
       return;
     case 0xFF45:
@@ -490,6 +731,7 @@ void PPU::Write(const uint16_t addr, const uint8_t value) {
     case 0xFF46:
       spdlog::debug("DMA init");
       DMAInit(value);
+      ScheduleEvents();
       return;
     case 0xFF47:
       bgp_ = value;
@@ -583,3 +825,91 @@ bool PPU::WindowIsVisible() {
 uint8_t PPU::GetSpriteHeight() {
   return GetLCDControl(kLCDControlObjSize) ? 16 : 8;
 }
+
+// the screen buffer is output rather than state, so it isn't saved
+void PPU::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::PPU);
+  state.Write(cycles_);
+  state.Write(frames_);
+  state.Write(lastSync_);
+  state.Write(lcdc_);
+  state.Write(stat_);
+  state.Write(scy_);
+  state.Write(scx_);
+  state.Write(ly_);
+  state.Write(lyc_);
+  state.Write(bgp_);
+  state.Write(obp0_);
+  state.Write(obp1_);
+  state.Write(wy_);
+  state.Write(wx_);
+  state.Write(backgroundFIFO_);
+  state.Write(fetchStep_);
+  state.Write(fetcherX_);
+  state.Write(tileNumber_);
+  state.Write(tileRowOffset_);
+  state.Write(tileRow_);
+  state.Write(backgroundPalette_);
+  state.Write(lcdPushedX_);
+  state.Write(lcdLineX_);
+  state.Write(windowY_);
+  state.Write(fifoPushedX_);
+  state.Write(pixelTransferEnd_);
+  state.Write(spritesInLine_);
+  state.Write(fetchedSprites_);
+  state.Write(spriteRows_);
+  state.Write(sprite1Palette_);
+  state.Write(sprite2Palette_);
+  state.Write(dmaOffset_);
+  state.Write(dmaActive_);
+  state.Write(dmaByte_);
+  state.Write(dmaStartDelay_);
+  state.WriteBytes(oam_.data(), oam_.size() * sizeof(OAMData));
+  state.WriteBytes(vram_.data(), vram_.size());
+  state.EndSection();
+}
+
+void PPU::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::PPU);
+  state.Read(cycles_);
+  state.Read(frames_);
+  state.Read(lastSync_);
+  state.Read(lcdc_);
+  state.Read(stat_);
+  state.Read(scy_);
+  state.Read(scx_);
+  state.Read(ly_);
+  state.Read(lyc_);
+  state.Read(bgp_);
+  state.Read(obp0_);
+  state.Read(obp1_);
+  state.Read(wy_);
+  state.Read(wx_);
+  state.Read(backgroundFIFO_);
+  state.Read(fetchStep_);
+  state.Read(fetcherX_);
+  state.Read(tileNumber_);
+  state.Read(tileRowOffset_);
+  state.Read(tileRow_);
+  state.Read(backgroundPalette_);
+  state.Read(lcdPushedX_);
+  lcdFlushedX_ = lcdPushedX_;
+  state.Read(lcdLineX_);
+  state.Read(windowY_);
+  state.Read(fifoPushedX_);
+  state.Read(pixelTransferEnd_);
+  state.Read(spritesInLine_);
+  state.Read(fetchedSprites_);
+  state.Read(spriteRows_);
+  state.Read(sprite1Palette_);
+  state.Read(sprite2Palette_);
+  state.Read(dmaOffset_);
+  state.Read(dmaActive_);
+  state.Read(dmaByte_);
+  state.Read(dmaStartDelay_);
+  state.ReadBytes(oam_.data(), oam_.size() * sizeof(OAMData));
+  state.ReadBytes(vram_.data(), vram_.size());
+
+  spriteFIFO_.clear();  // unused, and its entries point into oam
+  tileCache_.InvalidateAll();
+}
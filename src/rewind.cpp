@@ -0,0 +1,192 @@
+#include "rewind.h"
+
+#include <cstring>
+
+// equal runs shorter than this are cheaper to keep inside a literal
+const size_t kRewindMinZeroRun = 4;
+
+static size_t WriteVarint(uint8_t* out, size_t value) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    out[size++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[size++] = value;
+  return size;
+}
+
+static size_t ReadVarint(const uint8_t*& in) {
+  size_t value = 0;
+  for (int shift = 0;; shift += 7) {
+    uint8_t byte = *in++;
+    value |= size_t(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      return value;
+    }
+  }
+}
+
+static uint64_t Load64(const uint8_t* bytes) {
+  uint64_t value;
+  std::memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+// Encodes a ^ b as pairs of (equal bytes to skip, differing bytes) followed
+// by the xor of the differing bytes. out needs room for the worst case,
+// which is a little over size.
+static size_t EncodeDelta(const uint8_t* a, const uint8_t* b, const size_t size,
+                          uint8_t* out) {
+  size_t encoded = 0;
+  size_t i = 0;
+
+  while (i < size) {
+    size_t zerosStart = i;
+    while (i + 8 <= size && Load64(a + i) == Load64(b + i)) {
+      i += 8;
+    }
+    while (i < size && a[i] == b[i]) {
+      i++;
+    }
+
+    size_t literalStart = i;
+    while (i < size) {
+      if (a[i] != b[i]) {
+        i++;
+        continue;
+      }
+
+      size_t run = i;
+      while (run < size && run - i < kRewindMinZeroRun && a[run] == b[run]) {
+        run++;
+      }
+      if (run - i >= kRewindMinZeroRun || run == size) {
+        break;
+      }
+      i = run;
+    }
+
+    encoded += WriteVarint(out + encoded, literalStart - zerosStart);
+    encoded += WriteVarint(out + encoded, i - literalStart);
+    for (size_t j = literalStart; j < i; j++) {
+      out[encoded++] = a[j] ^ b[j];
+    }
+  }
+
+  return encoded;
+}
+
+static void ApplyDelta(const uint8_t* delta, const size_t size,
+                       uint8_t* state) {
+  const uint8_t* end = delta + size;
+  size_t offset = 0;
+
+  while (delta < end) {
+    offset += ReadVarint(delta);
+    size_t literal = ReadVarint(delta);
+    for (size_t i = 0; i < literal; i++) {
+      state[offset + i] ^= delta[i];
+    }
+    offset += literal;
+    delta += literal;
+  }
+}
+
+RewindBuffer::RewindBuffer(const size_t capacity)
+    : arena_(capacity), entries_(kRewindMaxSnapshots) {}
+
+RewindBuffer::~RewindBuffer() {}
+
+void RewindBuffer::Push(System& system) {
+  system.SaveState(scratch_);
+
+  // a state of a different size can't be diffed, start over from it
+  if (current_.size() != scratch_.size()) {
+    Clear();
+    current_.swap(scratch_);
+    return;
+  }
+
+  // far more than the encoding can grow to
+  if (delta_.size() < current_.size() * 3) {
+    delta_.resize(current_.size() * 3);
+  }
+  size_t size = EncodeDelta(current_.data(), scratch_.data(), current_.size(),
+                            delta_.data());
+  Store(size);
+  current_.swap(scratch_);
+}
+
+// Loads the newest snapshot and steps back to the one before it. The oldest
+// one is never dropped, so holding rewind stops there rather than failing.
+bool RewindBuffer::Rewind(System& system) {
+  if (current_.empty() || !system.LoadState(current_)) {
+    return false;
+  }
+
+  if (count_ > 0) {
+    RewindEntry& entry = Newest();
+    ApplyDelta(arena_.data() + entry.offset, entry.size, current_.data());
+    writeOffset_ = entry.offset;
+    count_--;
+  }
+
+  return true;
+}
+
+void RewindBuffer::Clear() {
+  head_ = 0;
+  count_ = 0;
+  writeOffset_ = 0;
+  current_.clear();
+}
+
+size_t RewindBuffer::Snapshots() const {
+  return current_.empty() ? 0 : count_ + 1;
+}
+
+size_t RewindBuffer::BytesUsed() const {
+  size_t used = current_.size();
+  for (size_t i = 0; i < count_; i++) {
+    used += entries_[(head_ + i) % entries_.size()].size;
+  }
+  return used;
+}
+
+RewindEntry& RewindBuffer::Newest() {
+  return entries_[(head_ + count_ - 1) % entries_.size()];
+}
+
+// copies delta_ into the arena after the newest entry, overwriting the
+// oldest ones it runs into
+void RewindBuffer::Store(const size_t size) {
+  if (size > arena_.size()) {
+    Clear();
+    return;
+  }
+
+  // entries past the wrap point are the oldest and go first
+  size_t tail = arena_.size();
+  if (writeOffset_ + size > arena_.size()) {
+    tail = writeOffset_;
+    writeOffset_ = 0;
+  }
+
+  while (count_ > 0) {
+    RewindEntry& oldest = entries_[head_];
+    bool overlaps = oldest.offset >= tail ||
+                    (oldest.offset < writeOffset_ + size &&
+                     oldest.offset + oldest.size > writeOffset_);
+    if (!overlaps && count_ < entries_.size()) {
+      break;
+    }
+
+    head_ = (head_ + 1) % entries_.size();
+    count_--;
+  }
+
+  std::memcpy(arena_.data() + writeOffset_, delta_.data(), size);
+  entries_[(head_ + count_) % entries_.size()] = {writeOffset_, size};
+  count_++;
+  writeOffset_ += size;
+}
@@ -0,0 +1,109 @@
+#include "save_state.h"
+
+const size_t kStateHeaderSize = 8;
+const size_t kStateSectionHeaderSize = 8;
+
+StateWriter::StateWriter(std::vector<uint8_t>& buffer) : buffer_(buffer) {
+  buffer_.clear();
+  Write(kStateMagic);
+  Write(kStateVersion);
+  Write(sectionCount_);
+}
+
+StateWriter::~StateWriter() {}
+
+void StateWriter::BeginSection(const StateSection section) {
+  sectionStart_ = buffer_.size();
+  Write(section);
+  Write(uint32_t(0));  // size, filled in by EndSection
+}
+
+void StateWriter::EndSection() {
+  uint32_t size = buffer_.size() - sectionStart_ - kStateSectionHeaderSize;
+  std::memcpy(buffer_.data() + sectionStart_ + 4, &size, sizeof(size));
+
+  sectionCount_++;
+  std::memcpy(buffer_.data() + 6, &sectionCount_, sizeof(sectionCount_));
+}
+
+void StateWriter::WriteBytes(const void* data, const size_t size) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  buffer_.insert(buffer_.end(), bytes, bytes + size);
+}
+
+StateReader::StateReader(const std::vector<uint8_t>& buffer)
+    : buffer_(buffer) {
+  uint32_t magic = 0;
+  uint16_t version = 0;
+  uint16_t sectionCount = 0;
+
+  sectionEnd_ = buffer_.size();
+  if (!Read(magic) || !Read(version) || !Read(sectionCount) ||
+      magic != kStateMagic || version != kStateVersion) {
+    return;
+  }
+
+  // index the sections, skipping any this build doesn't know about
+  size_t offset = kStateHeaderSize;
+  for (uint16_t i = 0; i < sectionCount; i++) {
+    uint32_t id = 0;
+    uint32_t size = 0;
+
+    position_ = offset;
+    if (!Read(id) || !Read(size) ||
+        size > buffer_.size() - offset - kStateSectionHeaderSize) {
+      return;
+    }
+
+    if (id < kStateSectionCount) {
+      offsets_[id] = offset + kStateSectionHeaderSize;
+      sizes_[id] = size;
+      present_[id] = true;
+    }
+
+    offset += kStateSectionHeaderSize + size;
+  }
+
+  valid_ = true;
+}
+
+StateReader::~StateReader() {}
+
+bool StateReader::BeginSection(const StateSection section) {
+  uint32_t index = static_cast<uint32_t>(section);
+  if (!valid_ || !present_[index]) {
+    failed_ = true;
+    return false;
+  }
+
+  position_ = offsets_[index];
+  sectionEnd_ = position_ + sizes_[index];
+  return true;
+}
+
+uint32_t StateReader::SectionSize(const StateSection section) {
+  uint32_t index = static_cast<uint32_t>(section);
+  return present_[index] ? sizes_[index] : 0;
+}
+
+bool StateReader::ReadBytes(void* data, const size_t size) {
+  const uint8_t* bytes = ReadSpan(size);
+  if (bytes == nullptr) {
+    return false;
+  }
+
+  std::memcpy(data, bytes, size);
+  return true;
+}
+
+// the next size bytes of the section in place, or nullptr past its end
+const uint8_t* StateReader::ReadSpan(const size_t size) {
+  if (size > sectionEnd_ - position_) {
+    failed_ = true;
+    return nullptr;
+  }
+
+  const uint8_t* bytes = buffer_.data() + position_;
+  position_ += size;
+  return bytes;
+}
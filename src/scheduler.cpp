@@ -0,0 +1,58 @@
+#include "scheduler.h"
+
+Scheduler::Scheduler() { events_.fill(kSchedulerNever); }
+
+Scheduler::~Scheduler() {}
+
+void Scheduler::Schedule(const EventType type, const uint64_t time) {
+  events_[static_cast<uint32_t>(type)] = time;
+  UpdateNextEvent();
+}
+
+void Scheduler::Cancel(const EventType type) {
+  Schedule(type, kSchedulerNever);
+}
+
+void Scheduler::RunEvents() {
+  // handlers may schedule more events that are already due
+  while (nextEvent_ <= now_) {
+    // earliest first, ties go to the lower event type
+    uint32_t earliest = 0;
+    for (uint32_t i = 1; i < kEventTypeCount; i++) {
+      if (events_[i] < events_[earliest]) {
+        earliest = i;
+      }
+    }
+
+    events_[earliest] = kSchedulerNever;
+    UpdateNextEvent();
+
+    if (handlers_[earliest] != nullptr) {
+      handlers_[earliest]->HandleEvent(static_cast<EventType>(earliest));
+    }
+  }
+}
+
+void Scheduler::UpdateNextEvent() {
+  nextEvent_ = kSchedulerNever;
+  for (auto time : events_) {
+    if (time < nextEvent_) {
+      nextEvent_ = time;
+    }
+  }
+}
+
+void Scheduler::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::SCHEDULER);
+  state.Write(now_);
+  state.Write(events_);
+  state.EndSection();
+}
+
+// events are absolute times, so they carry over as they are
+void Scheduler::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::SCHEDULER);
+  state.Read(now_);
+  state.Read(events_);
+  UpdateNextEvent();
+}
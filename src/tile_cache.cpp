@@ -0,0 +1,41 @@
+#include "tile_cache.h"
+
+#include "pixel_kernels.h"
+
+TileCache::TileCache() { InvalidateAll(); }
+
+TileCache::~TileCache() {}
+
+// offset is the VRAM offset of the row's low byte, as the fetcher computes it
+const TileRow& TileCache::Row(const std::vector<uint8_t>& vram,
+                              const uint16_t offset, const bool xFlip) {
+  uint16_t tile = offset / 16;
+  if (dirty_[tile]) {
+    Decode(vram, tile);
+  }
+
+  uint8_t row = (offset % 16) / 2;
+  return xFlip ? tiles_[tile].flippedRows[row] : tiles_[tile].rows[row];
+}
+
+void TileCache::Invalidate(const uint16_t offset) {
+  if (offset < kTileDataSize) {
+    dirty_[offset / 16] = true;
+  }
+}
+
+void TileCache::InvalidateAll() { dirty_.set(); }
+
+void TileCache::Decode(const std::vector<uint8_t>& vram, const uint16_t tile) {
+  DecodedTile& decoded = tiles_[tile];
+
+  for (int row = 0; row < 8; row++) {
+    uint8_t low = vram[tile * 16 + row * 2];
+    uint8_t high = vram[tile * 16 + row * 2 + 1];
+
+    DecodeTileRow(low, high, false, decoded.rows[row].data());
+    DecodeTileRow(low, high, true, decoded.flippedRows[row].data());
+  }
+
+  dirty_[tile] = false;
+}
@@ -1,49 +1,81 @@
 #include "timer.h"
 
+#include "cpu.h"
 #include "spdlog/spdlog.h"
 
-Timer::Timer() {}
+Timer::Timer(Scheduler& scheduler) : scheduler_(scheduler) {}
 
 Timer::~Timer() {}
 
-void Timer::Tick() {
-  uint16_t oldDiv =
-      div_;  // detect time for divider by comparing different bits for change
+void Timer::HandleEvent(const EventType /*type*/) { Sync(); }
 
-  div_++;
+void Timer::Sync() {
+  uint64_t from = Counter();
+  uint64_t to = scheduler_.now_ + counterOffset_;
 
-  uint8_t clockSelect = tac_ & 0b0011;
-  bool updateTima = false;
-  switch (clockSelect) {
-    case 0:  // every 1024 ticks
-      updateTima = (oldDiv & (1 << 9)) && (!(div_ & (1 << 9)));
-      break;
-    case 1:  // every 16 ticks
-      updateTima = (oldDiv & (1 << 3)) && (!(div_ & (1 << 3)));
-      break;
-    case 2:  // every 64
-      updateTima = (oldDiv & (1 << 5)) && (!(div_ & (1 << 5)));
-      break;
-    case 3:  // every 256
-      updateTima = (oldDiv & (1 << 7)) && (!(div_ & (1 << 7)));
-      break;
+  // one increment every time the selected bit goes from 1 to 0
+  if (tac_ & kTimerEnable) {
+    uint8_t shift = kTimerClockBits[tac_ & 0b0011] + 1;
+    IncrementTima((to >> shift) - (from >> shift));
+  }
+
+  lastSync_ = scheduler_.now_;
+
+  ScheduleEvents();
+}
+
+void Timer::ScheduleEvents() {
+  uint64_t cycles = CyclesUntilOverflow();
+  if (cycles == kSchedulerNever) {
+    scheduler_.Cancel(EventType::TIMER_OVERFLOW);
+  } else {
+    scheduler_.Schedule(EventType::TIMER_OVERFLOW, lastSync_ + cycles);
   }
+}
+
+// t-cycles after the last sync that TIMA next reloads
+uint64_t Timer::CyclesUntilOverflow() {
+  if (!(tac_ & kTimerEnable)) {
+    return kSchedulerNever;
+  }
+
+  uint64_t period = 2 << kTimerClockBits[tac_ & 0b0011];
+  uint64_t firstIncrement = period - (Counter() & (period - 1));
+  uint64_t increments = tima_ == 0xFF ? 0x100 : 0xFF - tima_;
+
+  return firstIncrement + (increments - 1) * period;
+}
 
-  if (updateTima && (tac_ & 0b0100)) {
-    tima_++;
+// internal counter as of the last sync, DIV is bits 8-15
+uint64_t Timer::Counter() { return lastSync_ + counterOffset_; }
 
-    if (tima_ == 0xFF) {
-      tima_ = tma_;
+// the signal TIMA is clocked by, which writes can also pull low
+bool Timer::TimaInput() {
+  return (tac_ & kTimerEnable) &&
+         (Counter() & (1 << kTimerClockBits[tac_ & 0b0011]));
+}
 
-      interruptHandler_->Request(kInterruptTimer);
+void Timer::IncrementTima(uint64_t increments) {
+  while (increments > 0) {
+    uint64_t untilOverflow = tima_ == 0xFF ? 0x100 : 0xFF - tima_;
+    if (increments < untilOverflow) {
+      tima_ += increments;
+      return;
     }
+
+    increments -= untilOverflow;
+    tima_ = tma_;
+
+    cpu_->Request(kInterruptTimer);
   }
 }
 
 const uint8_t Timer::Read(const uint16_t addr) {
+  Sync();
+
   switch (addr) {
     case 0xFF04:
-      return div_ >> 8;
+      return (Counter() >> 8) & 0xFF;
     case 0xFF05:
       return tima_;
     case 0xFF06:
@@ -58,9 +90,13 @@ const uint8_t Timer::Read(const uint16_t addr) {
 }
 
 void Timer::Write(const uint16_t addr, const uint8_t value) {
+  Sync();
+
+  bool input = TimaInput();
+
   switch (addr) {
     case 0xFF04:
-      div_ = 0;
+      counterOffset_ = -lastSync_;
       break;
     case 0xFF05:
       tima_ = value;
@@ -74,4 +110,30 @@ void Timer::Write(const uint16_t addr, const uint8_t value) {
     default:
       spdlog::warn("Unimplemented Timer memory write: {:4X}", addr);
   }
+
+  // resetting DIV or changing TAC can drop the input and count an edge
+  if (input && !TimaInput()) {
+    IncrementTima(1);
+  }
+
+  ScheduleEvents();
+}
+
+void Timer::SaveState(StateWriter& state) {
+  state.BeginSection(StateSection::TIMER);
+  state.Write(lastSync_);
+  state.Write(counterOffset_);
+  state.Write(tima_);
+  state.Write(tma_);
+  state.Write(tac_);
+  state.EndSection();
+}
+
+void Timer::LoadState(StateReader& state) {
+  state.BeginSection(StateSection::TIMER);
+  state.Read(lastSync_);
+  state.Read(counterOffset_);
+  state.Read(tima_);
+  state.Read(tma_);
+  state.Read(tac_);
 }
@@ -0,0 +1,149 @@
+// Checks that running frames never allocates once the system is warmed up,
+// with both the fifo and the scanline renderer, and with the ppu in lockstep.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#include "cart/cart.h"
+#include "cart/constants.h"
+#include "gameboy.h"
+
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  allocations++;
+  void* p = std::malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+
+const int kWarmupFrames = 10;
+const int kCheckedFrames = 30;
+
+const uint16_t kSpriteTable = 0x200;
+const int kSprites = 40;
+
+// A ROM only cartridge that copies a sprite table into OAM and a solid tile
+// into VRAM with the screen off, then turns it on with sprites and the
+// vblank interrupt enabled, and keeps filling work RAM and halting until the
+// next interrupt.
+static std::vector<uint8_t> SyntheticRom() {
+  std::vector<uint8_t> rom(0x8000);
+  rom[kCartType] = kRomOnly;
+
+  rom[0x40] = 0xD9;  // reti
+
+  const uint8_t program[] = {
+      0xAF,              // xor a
+      0xE0, 0x40,        // ldh (lcdc), a
+      0x21, 0x00, 0x02,  // ld hl, kSpriteTable
+      0x11, 0x00, 0xFE,  // ld de, $fe00
+      0x06, 0xA0,        // ld b, 4 * kSprites
+      0x2A,              // copy: ld a, (hl+)
+      0x12,              // ld (de), a
+      0x13,              // inc de
+      0x05,              // dec b
+      0x20, 0xFA,        // jr nz, copy
+      0x21, 0x10, 0x80,  // ld hl, $8010
+      0x3E, 0xFF,        // ld a, $ff
+      0x06, 0x10,        // ld b, 16
+      0x22,              // tile: ld (hl+), a
+      0x05,              // dec b
+      0x20, 0xFC,        // jr nz, tile
+      0x3E, 0xE4,        // ld a, $e4
+      0xE0, 0x47,        // ldh (bgp), a
+      0xE0, 0x48,        // ldh (obp0), a
+      0x3E, 0x93,        // ld a, $93
+      0xE0, 0x40,        // ldh (lcdc), a
+      0x3E, 0x01,        // ld a, $01
+      0xE0, 0xFF,        // ldh (ie), a
+      0xFB,              // ei
+      0x21, 0x00, 0xC0,  // loop: ld hl, $c000
+      0x06, 0x40,        // ld b, $40
+      0x22,              // fill: ld (hl+), a
+      0x3C,              // inc a
+      0x05,              // dec b
+      0x20, 0xFB,        // jr nz, fill
+      0x76,              // halt
+      0x18, 0xF3,        // jr loop
+  };
+  std::copy(std::begin(program), std::end(program), rom.begin() + 0x100);
+
+  // 12 sprites to a row, more than a line can show, out of x order and with
+  // every combination of flips, so the sorted insert, the per line limit and
+  // the sprite fetch all run
+  for (int i = 0; i < kSprites; i++) {
+    uint8_t* sprite = &rom[kSpriteTable + i * 4];
+    sprite[0] = 16 + 40 * (i / 12);  // y
+    sprite[1] = 8 + (i * 37) % 160;  // x
+    sprite[2] = 1;                   // tile
+    sprite[3] = (i % 4) << 5;        // x and y flip
+  }
+
+  return rom;
+}
+
+static bool RunWithoutAllocating(GameBoy<Cart>& gameboy, const char* name) {
+  for (int i = 0; i < kWarmupFrames; i++) {
+    if (!gameboy.RunFrame()) {
+      std::printf("%s: cpu error while warming up\n", name);
+      return false;
+    }
+  }
+
+  allocations = 0;
+  for (int i = 0; i < kCheckedFrames; i++) {
+    if (!gameboy.RunFrame()) {
+      std::printf("%s: cpu error\n", name);
+      return false;
+    }
+  }
+
+  if (allocations != 0) {
+    std::printf("%s: %zu allocations in %d frames\n", name, allocations,
+                kCheckedFrames);
+    return false;
+  }
+
+  std::printf("%s: no allocations in %d frames\n", name, kCheckedFrames);
+  return true;
+}
+
+int main() {
+  std::vector<uint8_t> rom = SyntheticRom();
+  GameBoy<Cart> gameboy(rom);
+
+  bool ok = true;
+
+  gameboy.ppu_.scanline_ = false;
+  ok &= RunWithoutAllocating(gameboy, "fifo");
+
+  gameboy.ppu_.scanline_ = true;
+  ok &= RunWithoutAllocating(gameboy, "scanline");
+
+  gameboy.ppu_.scanline_ = false;
+  gameboy.SetPPUCatchUp(false);
+  ok &= RunWithoutAllocating(gameboy, "lockstep");
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -2,8 +2,8 @@
 #include <emscripten/bind.h>
 
 #include <atomic>
-#include <chrono>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <string>
@@ -11,31 +11,21 @@
 #include <vector>
 
 #include "SDL2/SDL.h"
-#include "address_bus.h"
-#include "cart.h"
-#include "cpu.h"
-#include "io.h"
-#include "ppu.h"
+#include "frame_pacer.h"
+#include "gameboy.h"
 #include "spdlog/spdlog.h"
-#include "timer.h"
 
 SDL_Window* sdlWindow;
 SDL_Renderer* sdlRenderer;
 SDL_Texture* sdlTexture;
-SDL_Surface* sdlScreen;
 
 const int scale = 4;  // TODO make configurable
-const float targetMsPerFrame = (100.0) / 6.0;
 
 static std::atomic<bool> quit{false};
+static uint64_t presentedSequence = 0;
 static std::atomic<bool> run{false};
 
-static std::shared_ptr<Cart> cart = nullptr;
-static std::shared_ptr<AddressBus> addressBus = nullptr;
-static std::shared_ptr<CPU> cpu = nullptr;
-static std::shared_ptr<Timer> timer = nullptr;
-static std::shared_ptr<IO> io = nullptr;
-static std::shared_ptr<PPU> ppu = nullptr;
+static std::unique_ptr<System> gameboy = nullptr;
 
 static std::thread* cycleThread = nullptr;
 static std::atomic<bool> threadRunning{false};
@@ -43,10 +33,7 @@ static std::atomic<bool> threadRunning{false};
 static std::vector<uint8_t> romBuffer;
 static std::vector<uint8_t> saveBuffer;
 
-static uint32_t lastCycles = 0;
-static uint32_t lastFrameTime = 0;
 static uint32_t lastMeasureTime = 0;
-static uint32_t lastFrameCount = 0;
 static uint32_t frames = 0;
 
 void initWindow() {
@@ -55,76 +42,78 @@ void initWindow() {
     exit(-1);
   }
 
-  SDL_CreateWindowAndRenderer(kLCDWidth * scale, kLCDHeight * scale, 0,
-                              &sdlWindow, &sdlRenderer);
-  sdlScreen =
-      SDL_CreateRGBSurface(0, kLCDWidth * scale, kLCDHeight * scale, 32,
-                           0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+  // whole-pixel scaling of the native frame, letterboxed to keep its shape
+  SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");
+  SDL_CreateWindowAndRenderer(kLCDWidth * scale, kLCDHeight * scale,
+                              SDL_WINDOW_RESIZABLE, &sdlWindow, &sdlRenderer);
+  SDL_RenderSetLogicalSize(sdlRenderer, kLCDWidth, kLCDHeight);
+  SDL_RenderSetIntegerScale(sdlRenderer, SDL_TRUE);
   sdlTexture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_ARGB8888,
-                                 SDL_TEXTUREACCESS_STREAMING, kLCDWidth * scale,
-                                 kLCDHeight * scale);
+                                 SDL_TEXTUREACCESS_STREAMING, kLCDWidth,
+                                 kLCDHeight);
 }
 
-void updateWindow(std::shared_ptr<PPU> ppu) {
-  SDL_Rect rect;
-  rect.x = rect.y = 0;
-  rect.w = sdlScreen->w;
-  rect.h = sdlScreen->h;
-
-  // mimic how the ppu updates - left-to-right line-by-line
-  for (int y = 0; y < kLCDHeight; y++) {
-    for (int x = 0; x < kLCDWidth; x++) {
-      rect.x = x * scale;
-      rect.y = y * scale;
-      rect.w = scale;
-      rect.h = scale;
-
-      SDL_FillRect(sdlScreen, &rect, ppu->screenBuffer_[x + (y * 160)]);
+void updateWindow(PPU& ppu) {
+  // only whole frames are drawn, and only once
+  uint64_t sequence = ppu.frameBuffers_.Acquire();
+  if (sequence == presentedSequence) {
+    return;
+  }
+  presentedSequence = sequence;
+  const uint32_t* frame = ppu.frameBuffers_.Front();
+
+  // the renderer scales the 160x144 texture up
+  void* pixels;
+  int pitch;
+  if (SDL_LockTexture(sdlTexture, nullptr, &pixels, &pitch) == 0) {
+    for (uint32_t y = 0; y < kLCDHeight; y++) {
+      std::memcpy(static_cast<uint8_t*>(pixels) + y * pitch,
+                  frame + y * kLCDWidth, kLCDWidth * sizeof(uint32_t));
     }
+    SDL_UnlockTexture(sdlTexture);
   }
 
-  SDL_UpdateTexture(sdlTexture, nullptr, sdlScreen->pixels, sdlScreen->pitch);
   SDL_RenderClear(sdlRenderer);
   SDL_RenderCopy(sdlRenderer, sdlTexture, nullptr, nullptr);
   SDL_RenderPresent(sdlRenderer);
 }
 
-void handleKeyPress(SDL_Event e, std::shared_ptr<IO> io) {
+void handleKeyPress(SDL_Event e, IO& io) {
   SDL_KeyboardEvent keyEvent = e.key;
 
   bool pressed = !(keyEvent.type == SDL_KEYUP);
 
   switch (keyEvent.keysym.sym) {
     case SDLK_z:
-      io->a_ = pressed;
+      io.a_ = pressed;
       break;
     case SDLK_x:
-      io->b_ = pressed;
+      io.b_ = pressed;
       break;
     case SDLK_a:
-      io->start_ = pressed;
+      io.start_ = pressed;
       break;
     case SDLK_s:
-      io->select_ = pressed;
+      io.select_ = pressed;
       break;
     case SDLK_LEFT:
-      io->left_ = pressed;
+      io.left_ = pressed;
       break;
     case SDLK_RIGHT:
-      io->right_ = pressed;
+      io.right_ = pressed;
       break;
     case SDLK_UP:
-      io->up_ = pressed;
+      io.up_ = pressed;
       break;
     case SDLK_DOWN:
-      io->down_ = pressed;
+      io.down_ = pressed;
       break;
     default:
       spdlog::warn("Unmapped key pressed: {}", keyEvent.keysym.sym);
   }
 }
 
-void handleWindowEvents(std::shared_ptr<IO> io) {
+void handleWindowEvents(IO& io) {
   SDL_Event e;
   while (SDL_PollEvent(&e) > 0) {
     switch (e.type) {
@@ -134,7 +123,10 @@ void handleWindowEvents(std::shared_ptr<IO> io) {
       case SDL_WINDOWEVENT:
         if (e.window.event == SDL_WINDOWEVENT_CLOSE) {
           quit = true;
+        } else if (e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          presentedSequence = 0;  // redraw at the new size
         }
+        break;
       case SDL_KEYDOWN:
       case SDL_KEYUP:
         handleKeyPress(e, io);
@@ -144,45 +136,39 @@ void handleWindowEvents(std::shared_ptr<IO> io) {
   }
 }
 
+// paces frames as the ppu finishes them and reports frame times once a
+// second
+class FrameLimiter : public EventHandler {
+ public:
+  void HandleEvent(const EventType /*type*/) {
+    pacer.Wait();
+    frames++;
+
+    uint32_t currentMs = SDL_GetTicks();
+    if (currentMs - lastMeasureTime >= 1000) {
+      FramePacerStats stats = pacer.TakeStats();
+      spdlog::info(
+          "{} frames per second, frame time {:.3f} ms (jitter {:.3f} ms)",
+          frames, stats.meanMs, stats.jitterMs);
+      lastMeasureTime = currentMs;
+      frames = 0;
+    }
+  }
+
+  FramePacer pacer;
+};
+
+// outlives every gameboy, which only points at it
+static FrameLimiter frameLimiter;
+
 void runGameboy() {
   threadRunning = true;
   std::cout << "Starting Gameboy thread\n";
   while (!quit) {
-    if (cpu->Step() < 0) {
+    if (!gameboy->RunFrame()) {
       std::cout << "Error in CPU step\n";
       break;
     }
-
-    int elapsed = cpu->cycles_ - lastCycles;
-    // timer ticks 4 times every m cycle
-    for (int i = 0; i < 4 * elapsed; i++) {
-      timer->Tick();
-      ppu->Tick();
-    }
-
-    lastCycles = cpu->cycles_;
-
-    if (ppu->frames_ != lastFrameCount) {
-      uint32_t currentMs = SDL_GetTicks();
-      uint32_t frameMs = currentMs - lastFrameTime;
-      if (frameMs < targetMsPerFrame) {
-        std::this_thread::sleep_for(
-            std::chrono::milliseconds((int)targetMsPerFrame - frameMs));
-      }
-      if (currentMs - lastMeasureTime >= 1000) {
-        if (currentMs - lastMeasureTime < 1000) {
-          std::this_thread::sleep_for(
-              std::chrono::milliseconds((int)currentMs - lastMeasureTime));
-        }
-        spdlog::info("{} frames per second", frames);
-        lastMeasureTime = currentMs;
-        frames = 0;
-      }
-      frames++;
-      lastFrameTime = currentMs;
-      lastFrameCount = ppu->frames_;
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    }
   }
   std::cout << "Exiting Gameboy thread\n";
   threadRunning = false;
@@ -197,36 +183,23 @@ void initGameboy() {
   }
 
   // reset counters for frame timing
-  lastCycles = 0;
-  lastFrameTime = 0;
   lastMeasureTime = 0;
-  lastFrameCount = 0;
+  presentedSequence = 0;
   frames = 0;
 
-  cart = CreateCartridge(romBuffer);
-  std::cout << cart->Describe() << "\n";
+  gameboy = CreateGameBoy(romBuffer);
+  if (!gameboy) {
+    return;
+  }
+
+  std::cout << gameboy->GetCart().Describe() << "\n";
 
   if (saveBuffer.size() > 0) {
-    cart->Load(saveBuffer);
+    gameboy->GetCart().Load(saveBuffer);
   }
 
-  addressBus = std::make_shared<AddressBus>();
-  cpu = std::make_shared<CPU>();
-  timer = std::make_shared<Timer>();
-  io = std::make_shared<IO>();
-  ppu = std::make_shared<PPU>();
-
-  // connect up components
-  cpu->memory_ = addressBus;
-  addressBus->cart_ = cart;
-  addressBus->io_ = io;
-  addressBus->ppu_ = ppu;
-  io->timer_ = timer;
-  io->cpu_ = cpu;
-  io->ppu_ = ppu;
-  timer->interruptHandler_ = cpu;
-  ppu->memory_ = addressBus;
-  ppu->interruptHandler_ = cpu;
+  frameLimiter.pacer.Reset();
+  gameboy->scheduler_.handlers_[(int)EventType::FRAME_END] = &frameLimiter;
 
   quit = false;
   cycleThread = new std::thread(runGameboy);
@@ -236,14 +209,9 @@ void initGameboy() {
 }
 
 void mainLoop() {
-  if (run) {
-    if (ppu != nullptr) {
-      updateWindow(ppu);
-    }
-
-    if (io != nullptr) {
-      handleWindowEvents(io);
-    }
+  if (run && gameboy) {
+    updateWindow(gameboy->ppu_);
+    handleWindowEvents(gameboy->io_);
   }
 }
 
@@ -269,7 +237,7 @@ void clearSaveBuffer() { saveBuffer = {}; }
 void pushByteToSaveBuffer(uint8_t data) { saveBuffer.push_back(data); }
 
 emscripten::val readSaveData() {
-  std::vector<uint8_t> saveData = cart->Save();
+  std::vector<uint8_t> saveData = gameboy->GetCart().Save();
   return emscripten::val(
       emscripten::typed_memory_view(saveData.size(), saveData.data()));
 }